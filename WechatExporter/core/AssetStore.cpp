@@ -0,0 +1,198 @@
+//
+//  AssetStore.cpp
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+
+#include "AssetStore.h"
+#include <cstdio>
+#ifdef _WIN32
+#include <atlstr.h>
+#endif
+#include "Utils.h"
+#include "md5.h"
+
+#define ASSET_DIGEST_BUFFER_SIZE    (64 * 1024)
+
+AssetStore::AssetStore(OutputTree& outputTree, const FileCopier& fileCopier) : m_outputTree(outputTree), m_fileCopier(fileCopier), m_enabled(true)
+{
+}
+
+void AssetStore::setStorePath(const std::string& storePath)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (m_storePath == storePath)
+    {
+        return;
+    }
+    m_storePath = storePath;
+    m_assets.clear();
+    m_fileIds.clear();
+    m_sizes.clear();
+    m_enabled = true;
+}
+
+bool AssetStore::requireFile(const std::string& fileId, const std::string& srcPath, time_t mtime, const std::string& dest)
+{
+    uint64_t size = 0;
+    time_t srcTime = 0;
+    if (fileId.size() < 2 || !getFileSizeAndTime(srcPath, size, srcTime))
+    {
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mtx);
+    if (!m_enabled || m_storePath.empty())
+    {
+        return false;
+    }
+    std::unordered_map<std::string, size_t>::const_iterator it = m_fileIds.find(fileId);
+    if (it != m_fileIds.cend())
+    {
+        // The same file of the backup, e.g.: thumbs of forwarded messages
+        size_t index = it->second;
+        if (!waitForAsset(index, lock))
+        {
+            return false;
+        }
+        std::string assetPath = m_assets[index].path;
+        lock.unlock();
+        return linkToAsset(assetPath, dest, mtime);
+    }
+
+    // Keep the extension name so the file can be opened from the store too
+    std::string::size_type posSep = dest.find_last_of("/\\");
+    std::string::size_type posExt = dest.find_last_of('.');
+    std::string extName = (posExt != std::string::npos && (posSep == std::string::npos || posExt > posSep)) ? dest.substr(posExt) : "";
+    std::string assetDir = combinePath(m_storePath, fileId.substr(0, 2));
+
+    size_t index = m_assets.size();
+    m_assets.emplace_back();
+    Asset& asset = m_assets.back();
+    asset.path = combinePath(assetDir, fileId + extName);
+    asset.size = size;
+    asset.state = AS_PENDING;
+    m_fileIds[fileId] = index;
+
+    // Files with the same size may be the same content with different file ids, e.g.: forwarded to other chats
+    std::vector<size_t> candidates;
+    std::pair<std::unordered_multimap<uint64_t, size_t>::const_iterator, std::unordered_multimap<uint64_t, size_t>::const_iterator> range = m_sizes.equal_range(size);
+    for (std::unordered_multimap<uint64_t, size_t>::const_iterator itSize = range.first; itSize != range.second; ++itSize)
+    {
+        candidates.push_back(itSize->second);
+    }
+    std::unordered_multimap<uint64_t, size_t>::iterator itIndex = m_sizes.emplace(size, index);
+    std::string assetPath = asset.path;
+    lock.unlock();
+
+    std::string digest;
+    bool duplicated = false;
+    if (!candidates.empty() && buildDigest(srcPath, digest))
+    {
+        for (std::vector<size_t>::const_iterator itCandidate = candidates.cbegin(); itCandidate != candidates.cend(); ++itCandidate)
+        {
+            lock.lock();
+            bool ready = waitForAsset(*itCandidate, lock);
+            std::string candidatePath = m_assets[*itCandidate].path;
+            std::string candidateDigest = m_assets[*itCandidate].digest;
+            lock.unlock();
+            if (!ready)
+            {
+                continue;
+            }
+            if (candidateDigest.empty())
+            {
+                if (!buildDigest(candidatePath, candidateDigest))
+                {
+                    continue;
+                }
+                lock.lock();
+                m_assets[*itCandidate].digest = candidateDigest;
+                lock.unlock();
+            }
+            if (candidateDigest == digest)
+            {
+                assetPath = candidatePath;
+                duplicated = true;
+                break;
+            }
+        }
+    }
+
+    bool succeeded = true;
+    if (!duplicated)
+    {
+        m_outputTree.ensureDirectory(assetDir);
+        succeeded = m_fileCopier.copyFile(srcPath, assetPath, mtime);
+    }
+
+    lock.lock();
+    m_assets[index].state = succeeded ? AS_READY : AS_FAILED;
+    m_assets[index].path = assetPath;
+    m_assets[index].digest.swap(digest);
+    if (duplicated || !succeeded)
+    {
+        // Compare the later files with the first one only
+        m_sizes.erase(itIndex);
+    }
+    m_cond.notify_all();
+    lock.unlock();
+
+    return succeeded && linkToAsset(assetPath, dest, mtime);
+}
+
+bool AssetStore::waitForAsset(size_t index, std::unique_lock<std::mutex>& lock)
+{
+    while (m_assets[index].state == AS_PENDING)
+    {
+        m_cond.wait(lock);
+    }
+    return m_assets[index].state == AS_READY;
+}
+
+bool AssetStore::buildDigest(const std::string& path, std::string& digest) const
+{
+#ifdef _WIN32
+    CA2W pszW(path.c_str(), CP_UTF8);
+    FILE* file = _wfopen(pszW, L"rb");
+#else
+    FILE* file = fopen(path.c_str(), "rb");
+#endif
+    if (NULL == file)
+    {
+        return false;
+    }
+
+    std::vector<unsigned char> buffer(ASSET_DIGEST_BUFFER_SIZE);
+    MD5_CTX ctx;
+    MD5Init(&ctx);
+    size_t bytesRead = 0;
+    while ((bytesRead = fread(&buffer[0], 1, buffer.size(), file)) > 0)
+    {
+        MD5Update(&ctx, &buffer[0], static_cast<unsigned>(bytesRead));
+    }
+    bool succeeded = ferror(file) == 0;
+    fclose(file);
+
+    unsigned char result[16] = { 0 };
+    MD5Final(result, &ctx);
+    digest.assign(reinterpret_cast<const char *>(result), sizeof(result));
+    return succeeded;
+}
+
+bool AssetStore::linkToAsset(const std::string& assetPath, const std::string& dest, time_t mtime)
+{
+    if (m_fileCopier.linkFile(assetPath, dest))
+    {
+        return true;
+    }
+
+    // No links on this file system, e.g.: FAT, stop writing the store
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_enabled = false;
+    }
+    return m_fileCopier.copyFile(assetPath, dest, mtime);
+}
@@ -0,0 +1,73 @@
+//
+//  AssetStore.h
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+
+#ifndef AssetStore_h
+#define AssetStore_h
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include "FileCopier.h"
+#include "OutputTree.h"
+
+// Content-addressed store of the media files of an account: <output>/Assets/<xx>/<fileId>.<ext>
+// Every distinct file of the backup is written into the store once, and the files in the folders of sessions
+// are links to it, so the same image forwarded to many chats costs one copy
+// Files are keyed by the file id of the backup first; files with different ids are compared by md5 only when
+// their sizes are the same
+// If the file system supports no links, the store turns itself off and the files are copied as before
+// Thread-safe
+class AssetStore
+{
+protected:
+    enum AssetState
+    {
+        AS_PENDING = 0,
+        AS_READY,
+        AS_FAILED
+    };
+
+    struct Asset
+    {
+        std::string path;       // Path in the store
+        uint64_t size;
+        std::string digest;     // Raw md5, computed on demand
+        AssetState state;
+    };
+
+    OutputTree& m_outputTree;
+    const FileCopier& m_fileCopier;
+    std::string m_storePath;
+
+    mutable std::mutex m_mtx;
+    std::condition_variable m_cond;
+    std::vector<Asset> m_assets;
+    std::unordered_map<std::string, size_t> m_fileIds;              // fileId => index of asset
+    std::unordered_multimap<uint64_t, size_t> m_sizes;              // size => index of asset
+    bool m_enabled;
+
+public:
+    AssetStore(OutputTree& outputTree, const FileCopier& fileCopier);
+
+    // Nothing is changed if the path is the same
+    void setStorePath(const std::string& storePath);
+
+    // False if the store is off, the caller copies the file then
+    bool requireFile(const std::string& fileId, const std::string& srcPath, time_t mtime, const std::string& dest);
+
+protected:
+    bool waitForAsset(size_t index, std::unique_lock<std::mutex>& lock);
+    bool buildDigest(const std::string& path, std::string& digest) const;
+    bool linkToAsset(const std::string& assetPath, const std::string& dest, time_t mtime);
+};
+
+#endif /* AssetStore_h */
@@ -0,0 +1,145 @@
+//
+//  AudioTranscoder.cpp
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+
+#include "AudioTranscoder.h"
+#include <cstdio>
+#include "Utils.h"
+
+AudioTranscoder::AudioTranscoder(unsigned int numberOfWorkers/* = 0*/) : m_numberOfWorkers(numberOfWorkers == 0 ? std::thread::hardware_concurrency() : numberOfWorkers), m_queue((m_numberOfWorkers == 0 ? 1 : m_numberOfWorkers) * QUEUE_SIZE_PER_WORKER), m_numberOfPendingJobs(0), m_maxNumberOfPendingJobs(0), m_numberOfConversions(0), m_numberOfFailures(0), m_busySeconds(0)
+{
+    if (m_numberOfWorkers == 0)
+    {
+        m_numberOfWorkers = 1;
+    }
+}
+
+AudioTranscoder::~AudioTranscoder()
+{
+    m_queue.close();
+    for (std::vector<std::thread>::iterator it = m_threads.begin(); it != m_threads.end(); ++it)
+    {
+        it->join();
+    }
+    m_threads.clear();
+}
+
+void AudioTranscoder::submit(const std::string& audioPath, const std::string& mp3Path, time_t mtime)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (m_threads.empty())
+        {
+            for (unsigned int idx = 0; idx < m_numberOfWorkers; ++idx)
+            {
+                m_threads.emplace_back(&AudioTranscoder::run, this);
+            }
+        }
+        if (m_numberOfPendingJobs == 0)
+        {
+            m_busySince = std::chrono::steady_clock::now();
+        }
+        ++m_numberOfPendingJobs;
+        if (m_numberOfPendingJobs > m_maxNumberOfPendingJobs)
+        {
+            m_maxNumberOfPendingJobs = m_numberOfPendingJobs;
+        }
+    }
+
+    Job job;
+    job.audioPath = audioPath;
+    job.mp3Path = mp3Path;
+    job.mtime = mtime;
+    // Blocks while the workers are behind
+    if (!m_queue.push(std::move(job)))
+    {
+        complete(false);
+    }
+}
+
+void AudioTranscoder::waitForCompletion()
+{
+    std::unique_lock<std::mutex> lock(m_mtx);
+    while (m_numberOfPendingJobs > 0)
+    {
+        m_completed.wait(lock);
+    }
+}
+
+size_t AudioTranscoder::getQueueDepth() const
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return m_numberOfPendingJobs;
+}
+
+double AudioTranscoder::getConversionsPerSecond() const
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    double seconds = m_busySeconds;
+    if (m_numberOfPendingJobs > 0)
+    {
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_busySince).count();
+    }
+    return seconds > 0 ? m_numberOfConversions / seconds : 0.0;
+}
+
+std::string AudioTranscoder::getStatistics() const
+{
+    uint64_t numberOfConversions = 0;
+    uint64_t numberOfFailures = 0;
+    size_t maxNumberOfPendingJobs = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        numberOfConversions = m_numberOfConversions;
+        numberOfFailures = m_numberOfFailures;
+        maxNumberOfPendingJobs = m_maxNumberOfPendingJobs;
+    }
+    if (numberOfConversions == 0 && numberOfFailures == 0)
+    {
+        return std::string();
+    }
+
+    char buffer[160] = { 0 };
+    snprintf(buffer, sizeof(buffer), "%llu converted, %llu failed, %.1f/s, max queue depth %llu", static_cast<unsigned long long>(numberOfConversions), static_cast<unsigned long long>(numberOfFailures), getConversionsPerSecond(), static_cast<unsigned long long>(maxNumberOfPendingJobs));
+    return std::string(buffer);
+}
+
+void AudioTranscoder::run()
+{
+    // The pcm buffer of the worker is reused by its jobs
+    std::vector<unsigned char> pcmData;
+    Job job;
+    while (m_queue.pop(job))
+    {
+        pcmData.clear();
+        bool converted = silkToPcm(job.audioPath, pcmData) && pcmToMp3(pcmData, job.mp3Path);
+        if (converted && job.mtime != 0)
+        {
+            updateFileTime(job.mp3Path, job.mtime);
+        }
+        complete(converted);
+    }
+}
+
+void AudioTranscoder::complete(bool converted)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (converted)
+    {
+        ++m_numberOfConversions;
+    }
+    else
+    {
+        ++m_numberOfFailures;
+    }
+    --m_numberOfPendingJobs;
+    if (m_numberOfPendingJobs == 0)
+    {
+        m_busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_busySince).count();
+        m_completed.notify_all();
+    }
+}
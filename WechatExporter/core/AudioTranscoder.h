@@ -0,0 +1,78 @@
+//
+//  AudioTranscoder.h
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+
+#ifndef AudioTranscoder_h
+#define AudioTranscoder_h
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <ctime>
+#include <cstdint>
+#include "BlockingQueue.h"
+
+// Converts the voice messages (silk) into mp3 on workers of its own, so that a slow LAME encode doesn't hold up parsing:
+// the page refers to the mp3 as soon as the job is submitted, and the owner waits for the jobs at the end of the session
+// The queue is bounded, submit blocks while it's full; the workers start with the first job
+class AudioTranscoder
+{
+public:
+    // Jobs which wait in the queue for each worker
+    static const size_t QUEUE_SIZE_PER_WORKER = 4;
+
+protected:
+    struct Job
+    {
+        std::string audioPath;
+        std::string mp3Path;
+        time_t mtime;           // Given to the mp3, 0 to keep the time of writing
+    };
+
+    unsigned int m_numberOfWorkers;
+    BlockingQueue<Job> m_queue;
+    std::vector<std::thread> m_threads;
+
+    mutable std::mutex m_mtx;
+    std::condition_variable m_completed;
+    size_t m_numberOfPendingJobs;       // Submitted and not converted yet
+    size_t m_maxNumberOfPendingJobs;
+    uint64_t m_numberOfConversions;
+    uint64_t m_numberOfFailures;
+    std::chrono::steady_clock::time_point m_busySince;
+    double m_busySeconds;               // Time with pending jobs
+
+public:
+    // numberOfWorkers: 0 for the number of cores
+    explicit AudioTranscoder(unsigned int numberOfWorkers = 0);
+    // Converts the jobs in the queue before it returns
+    ~AudioTranscoder();
+
+    // mtime: 0 to keep the time of writing
+    void submit(const std::string& audioPath, const std::string& mp3Path, time_t mtime);
+    // Waits for the jobs which are submitted before
+    void waitForCompletion();
+
+    size_t getQueueDepth() const;
+    // Conversions per second of the time when there are pending jobs
+    double getConversionsPerSecond() const;
+    // e.g.: "120 converted, 0 failed, 35.2/s, max queue depth 16", empty if nothing is submitted
+    std::string getStatistics() const;
+
+protected:
+    void run();
+    void complete(bool converted);
+
+private:
+    AudioTranscoder(const AudioTranscoder&);
+    AudioTranscoder& operator=(const AudioTranscoder&);
+};
+
+#endif /* AudioTranscoder_h */
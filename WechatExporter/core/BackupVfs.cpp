@@ -0,0 +1,497 @@
+//
+//  BackupVfs.cpp
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+
+#include "BackupVfs.h"
+#include <sqlite3.h>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <algorithm>
+#ifdef _WIN32
+#include <windows.h>
+#include <atlstr.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "ITunesParser.h"
+
+// SQLite allocates it (szOsFile bytes), so it holds no C++ objects
+struct BackupVfsFile
+{
+    sqlite3_file base;
+    const unsigned char* data;      // The mapping of the first mappedSize bytes, NULL if nothing is mapped
+    uint64_t mappedSize;
+    uint64_t size;
+    uint64_t nextOffset;            // Where the next read starts if the reads are sequential
+    uint64_t prefetchedEnd;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+};
+
+static inline BackupVfs* getBackupVfs(sqlite3_vfs* vfs)
+{
+    return reinterpret_cast<BackupVfs *>(vfs->pAppData);
+}
+
+static inline sqlite3_vfs* getParentVfs(sqlite3_vfs* vfs)
+{
+    return getBackupVfs(vfs)->getParent();
+}
+
+// maxMmapSize: bytes mapped at most (SqliteReadProfile), 0 to read the whole file without the mapping
+static bool openBackupFile(BackupVfsFile* f, const std::string& path, uint64_t maxMmapSize)
+{
+#ifdef _WIN32
+    CA2W pszW(path.c_str(), CP_UTF8);
+    f->file = CreateFileW(pszW, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == f->file)
+    {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(f->file, &size))
+    {
+        return false;
+    }
+    f->size = static_cast<uint64_t>(size.QuadPart);
+    uint64_t mappedSize = std::min(f->size, maxMmapSize);
+    if (mappedSize > 0 && mappedSize <= static_cast<uint64_t>(SIZE_MAX))
+    {
+        f->mapping = CreateFileMappingW(f->file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (NULL != f->mapping)
+        {
+            f->data = reinterpret_cast<const unsigned char *>(MapViewOfFile(f->mapping, FILE_MAP_READ, 0, 0, static_cast<SIZE_T>(mappedSize)));
+        }
+    }
+#else
+    f->fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (f->fd == -1)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(f->fd, &st) != 0)
+    {
+        return false;
+    }
+    f->size = static_cast<uint64_t>(st.st_size);
+    uint64_t mappedSize = std::min(f->size, maxMmapSize);
+    if (mappedSize > 0 && mappedSize <= static_cast<uint64_t>(SIZE_MAX))
+    {
+        void* data = mmap(NULL, static_cast<size_t>(mappedSize), PROT_READ, MAP_SHARED, f->fd, 0);
+        if (MAP_FAILED != data)
+        {
+            f->data = reinterpret_cast<const unsigned char *>(data);
+        }
+    }
+#endif
+    // The part after the mapping, or the file which can't be mapped, is read without the mapping
+    f->mappedSize = NULL == f->data ? 0 : mappedSize;
+    return true;
+}
+
+static void closeBackupFile(BackupVfsFile* f)
+{
+#ifdef _WIN32
+    if (NULL != f->data)
+    {
+        UnmapViewOfFile(f->data);
+    }
+    if (NULL != f->mapping)
+    {
+        CloseHandle(f->mapping);
+    }
+    if (INVALID_HANDLE_VALUE != f->file)
+    {
+        CloseHandle(f->file);
+    }
+#else
+    if (NULL != f->data)
+    {
+        munmap(const_cast<unsigned char *>(f->data), static_cast<size_t>(f->mappedSize));
+    }
+    if (f->fd != -1)
+    {
+        close(f->fd);
+    }
+#endif
+    f->data = NULL;
+    f->mappedSize = 0;
+}
+
+// Bytes read, -1 on error
+static int64_t readBackupFile(BackupVfsFile* f, void* buffer, size_t length, uint64_t offset)
+{
+    size_t bytesRead = 0;
+    while (bytesRead < length)
+    {
+#ifdef _WIN32
+        OVERLAPPED overlapped;
+        memset(&overlapped, 0, sizeof(overlapped));
+        overlapped.Offset = static_cast<DWORD>((offset + bytesRead) & 0xFFFFFFFF);
+        overlapped.OffsetHigh = static_cast<DWORD>((offset + bytesRead) >> 32);
+        DWORD bytes = 0;
+        if (!ReadFile(f->file, reinterpret_cast<unsigned char *>(buffer) + bytesRead, static_cast<DWORD>(length - bytesRead), &bytes, &overlapped))
+        {
+            return GetLastError() == ERROR_HANDLE_EOF ? static_cast<int64_t>(bytesRead) : -1;
+        }
+#else
+        ssize_t bytes = pread(f->fd, reinterpret_cast<unsigned char *>(buffer) + bytesRead, length - bytesRead, static_cast<off_t>(offset + bytesRead));
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+#endif
+        if (bytes == 0)
+        {
+            break;
+        }
+        bytesRead += static_cast<size_t>(bytes);
+    }
+    return static_cast<int64_t>(bytesRead);
+}
+
+// The pages after a sequential read are paged in ahead, a random read doesn't prefetch anything
+// Windows clusters the page faults of mapped files by itself
+static void prefetchBackupFile(BackupVfsFile* f, uint64_t offset, uint64_t length)
+{
+    bool sequential = offset == f->nextOffset;
+    f->nextOffset = offset + length;
+#ifndef _WIN32
+    if (!sequential || f->nextOffset + BackupVfs::READAHEAD_SIZE / 2 < f->prefetchedEnd)
+    {
+        return;
+    }
+    static const uint64_t pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    uint64_t start = std::max(f->prefetchedEnd, f->nextOffset) / pageSize * pageSize;
+    uint64_t end = std::min(start + BackupVfs::READAHEAD_SIZE, f->mappedSize);
+    if (start < end)
+    {
+        madvise(const_cast<unsigned char *>(f->data + start), static_cast<size_t>(end - start), MADV_WILLNEED);
+        f->prefetchedEnd = end;
+    }
+#endif
+}
+
+static int backupVfsClose(sqlite3_file* file)
+{
+    closeBackupFile(reinterpret_cast<BackupVfsFile *>(file));
+    return SQLITE_OK;
+}
+
+static int backupVfsRead(sqlite3_file* file, void* buffer, int amount, sqlite3_int64 offset)
+{
+    BackupVfsFile* f = reinterpret_cast<BackupVfsFile *>(file);
+    uint64_t available = (offset < 0 || static_cast<uint64_t>(offset) >= f->size) ? 0 : std::min(static_cast<uint64_t>(amount), f->size - static_cast<uint64_t>(offset));
+    if (available > 0)
+    {
+        if (static_cast<uint64_t>(offset) + available <= f->mappedSize)
+        {
+            prefetchBackupFile(f, offset, available);
+            memcpy(buffer, f->data + offset, static_cast<size_t>(available));
+        }
+        else
+        {
+            int64_t bytesRead = readBackupFile(f, buffer, static_cast<size_t>(available), offset);
+            if (bytesRead < 0)
+            {
+                return SQLITE_IOERR_READ;
+            }
+            available = static_cast<uint64_t>(bytesRead);
+        }
+    }
+    if (available < static_cast<uint64_t>(amount))
+    {
+        // SQLite expects the rest to be zeroed
+        memset(reinterpret_cast<unsigned char *>(buffer) + available, 0, static_cast<size_t>(amount - available));
+        return SQLITE_IOERR_SHORT_READ;
+    }
+    return SQLITE_OK;
+}
+
+static int backupVfsWrite(sqlite3_file*, const void*, int, sqlite3_int64)
+{
+    return SQLITE_READONLY;
+}
+
+static int backupVfsTruncate(sqlite3_file*, sqlite3_int64)
+{
+    return SQLITE_READONLY;
+}
+
+static int backupVfsSync(sqlite3_file*, int)
+{
+    return SQLITE_OK;
+}
+
+static int backupVfsFileSize(sqlite3_file* file, sqlite3_int64* size)
+{
+    *size = static_cast<sqlite3_int64>(reinterpret_cast<BackupVfsFile *>(file)->size);
+    return SQLITE_OK;
+}
+
+static int backupVfsLock(sqlite3_file*, int)
+{
+    return SQLITE_OK;
+}
+
+static int backupVfsUnlock(sqlite3_file*, int)
+{
+    return SQLITE_OK;
+}
+
+static int backupVfsCheckReservedLock(sqlite3_file*, int* resOut)
+{
+    *resOut = 0;
+    return SQLITE_OK;
+}
+
+static int backupVfsFileControl(sqlite3_file*, int, void*)
+{
+    return SQLITE_NOTFOUND;
+}
+
+static int backupVfsSectorSize(sqlite3_file*)
+{
+    return 0;
+}
+
+static int backupVfsDeviceCharacteristics(sqlite3_file*)
+{
+    // The pager neither locks nor looks for a hot journal or a WAL file, as with immutable=1 in the URI
+    return SQLITE_IOCAP_IMMUTABLE;
+}
+
+static int backupVfsFetch(sqlite3_file* file, sqlite3_int64 offset, int amount, void** pp)
+{
+    BackupVfsFile* f = reinterpret_cast<BackupVfsFile *>(file);
+    *pp = NULL;
+    if (NULL != f->data && offset >= 0 && static_cast<uint64_t>(offset) + amount <= f->mappedSize)
+    {
+        prefetchBackupFile(f, offset, amount);
+        *pp = const_cast<unsigned char *>(f->data + offset);
+    }
+    return SQLITE_OK;
+}
+
+static int backupVfsUnfetch(sqlite3_file*, sqlite3_int64, void*)
+{
+    return SQLITE_OK;
+}
+
+static const sqlite3_io_methods s_backupVfsIoMethods = {
+    3,
+    backupVfsClose,
+    backupVfsRead,
+    backupVfsWrite,
+    backupVfsTruncate,
+    backupVfsSync,
+    backupVfsFileSize,
+    backupVfsLock,
+    backupVfsUnlock,
+    backupVfsCheckReservedLock,
+    backupVfsFileControl,
+    backupVfsSectorSize,
+    backupVfsDeviceCharacteristics,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    backupVfsFetch,
+    backupVfsUnfetch
+};
+
+static int backupVfsOpen(sqlite3_vfs* vfs, const char* name, sqlite3_file* file, int flags, int* outFlags)
+{
+    sqlite3_vfs* parent = getParentVfs(vfs);
+    if (NULL == name || (flags & SQLITE_OPEN_MAIN_DB) == 0 || (flags & (SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE)) != 0)
+    {
+        return parent->xOpen(parent, name, file, flags, outFlags);
+    }
+
+    BackupVfs* backupVfs = getBackupVfs(vfs);
+    BackupVfsFile* f = reinterpret_cast<BackupVfsFile *>(file);
+    memset(f, 0, sizeof(BackupVfsFile));
+#ifdef _WIN32
+    f->file = INVALID_HANDLE_VALUE;
+#else
+    f->fd = -1;
+#endif
+
+    std::string path = backupVfs->resolvePath(name);
+    if (!openBackupFile(f, path, getSqliteReadProfile().maxMmapSize))
+    {
+        closeBackupFile(f);
+        return SQLITE_CANTOPEN;
+    }
+    if (NULL != outFlags)
+    {
+        *outFlags = flags;
+    }
+    file->pMethods = &s_backupVfsIoMethods;
+    return SQLITE_OK;
+}
+
+static int backupVfsDelete(sqlite3_vfs* vfs, const char* name, int syncDir)
+{
+    sqlite3_vfs* parent = getParentVfs(vfs);
+    return parent->xDelete(parent, name, syncDir);
+}
+
+static int backupVfsAccess(sqlite3_vfs* vfs, const char* name, int flags, int* resOut)
+{
+    sqlite3_vfs* parent = getParentVfs(vfs);
+    return parent->xAccess(parent, getBackupVfs(vfs)->resolvePath(name).c_str(), flags, resOut);
+}
+
+static int backupVfsFullPathname(sqlite3_vfs*, const char* name, int outSize, char* out)
+{
+    // Kept as it is, which is resolved when it's opened
+    sqlite3_snprintf(outSize, out, "%s", name);
+    return SQLITE_OK;
+}
+
+static void* backupVfsDlOpen(sqlite3_vfs* vfs, const char* fileName)
+{
+    sqlite3_vfs* parent = getParentVfs(vfs);
+    return parent->xDlOpen(parent, fileName);
+}
+
+static void backupVfsDlError(sqlite3_vfs* vfs, int bytes, char* errMsg)
+{
+    sqlite3_vfs* parent = getParentVfs(vfs);
+    parent->xDlError(parent, bytes, errMsg);
+}
+
+static void (*backupVfsDlSym(sqlite3_vfs* vfs, void* handle, const char* symbol))(void)
+{
+    sqlite3_vfs* parent = getParentVfs(vfs);
+    return parent->xDlSym(parent, handle, symbol);
+}
+
+static void backupVfsDlClose(sqlite3_vfs* vfs, void* handle)
+{
+    sqlite3_vfs* parent = getParentVfs(vfs);
+    parent->xDlClose(parent, handle);
+}
+
+static int backupVfsRandomness(sqlite3_vfs* vfs, int bytes, char* out)
+{
+    sqlite3_vfs* parent = getParentVfs(vfs);
+    return parent->xRandomness(parent, bytes, out);
+}
+
+static int backupVfsSleep(sqlite3_vfs* vfs, int microseconds)
+{
+    sqlite3_vfs* parent = getParentVfs(vfs);
+    return parent->xSleep(parent, microseconds);
+}
+
+static int backupVfsCurrentTime(sqlite3_vfs* vfs, double* time)
+{
+    sqlite3_vfs* parent = getParentVfs(vfs);
+    return parent->xCurrentTime(parent, time);
+}
+
+static int backupVfsGetLastError(sqlite3_vfs* vfs, int bytes, char* out)
+{
+    sqlite3_vfs* parent = getParentVfs(vfs);
+    return NULL == parent->xGetLastError ? 0 : parent->xGetLastError(parent, bytes, out);
+}
+
+static int backupVfsCurrentTimeInt64(sqlite3_vfs* vfs, sqlite3_int64* time)
+{
+    sqlite3_vfs* parent = getParentVfs(vfs);
+    if (parent->iVersion >= 2 && NULL != parent->xCurrentTimeInt64)
+    {
+        return parent->xCurrentTimeInt64(parent, time);
+    }
+    double days = 0;
+    int rc = parent->xCurrentTime(parent, &days);
+    *time = static_cast<sqlite3_int64>(days * 86400000.0);
+    return rc;
+}
+
+BackupVfs::BackupVfs(const ITunesDb* iTunesDb) : m_vfs(NULL), m_parent(NULL), m_iTunesDb(iTunesDb)
+{
+    static std::atomic<unsigned int> numberOfVfs(0);
+    m_name = "wxbackup" + std::to_string(++numberOfVfs);
+
+    m_parent = sqlite3_vfs_find(NULL);
+    if (NULL == m_parent)
+    {
+        return;
+    }
+
+    m_vfs = new sqlite3_vfs();
+    memset(m_vfs, 0, sizeof(sqlite3_vfs));
+    m_vfs->iVersion = 2;
+    m_vfs->szOsFile = std::max(static_cast<int>(sizeof(BackupVfsFile)), m_parent->szOsFile);
+    m_vfs->mxPathname = m_parent->mxPathname;
+    m_vfs->zName = m_name.c_str();
+    m_vfs->pAppData = this;
+    m_vfs->xOpen = backupVfsOpen;
+    m_vfs->xDelete = backupVfsDelete;
+    m_vfs->xAccess = backupVfsAccess;
+    m_vfs->xFullPathname = backupVfsFullPathname;
+    m_vfs->xDlOpen = backupVfsDlOpen;
+    m_vfs->xDlError = backupVfsDlError;
+    m_vfs->xDlSym = backupVfsDlSym;
+    m_vfs->xDlClose = backupVfsDlClose;
+    m_vfs->xRandomness = backupVfsRandomness;
+    m_vfs->xSleep = backupVfsSleep;
+    m_vfs->xCurrentTime = backupVfsCurrentTime;
+    m_vfs->xGetLastError = backupVfsGetLastError;
+    m_vfs->xCurrentTimeInt64 = backupVfsCurrentTimeInt64;
+
+    if (sqlite3_vfs_register(m_vfs, 0) != SQLITE_OK)
+    {
+        delete m_vfs;
+        m_vfs = NULL;
+    }
+}
+
+BackupVfs::~BackupVfs()
+{
+    if (NULL != m_vfs)
+    {
+        sqlite3_vfs_unregister(m_vfs);
+        delete m_vfs;
+        m_vfs = NULL;
+    }
+}
+
+const char* BackupVfs::getName() const
+{
+    return NULL == m_vfs ? NULL : m_name.c_str();
+}
+
+std::string BackupVfs::resolvePath(const std::string& name) const
+{
+    if (NULL != m_iTunesDb)
+    {
+        std::string realPath = m_iTunesDb->findRealPath(name);
+        if (!realPath.empty())
+        {
+            return realPath;
+        }
+    }
+    return name;
+}
@@ -0,0 +1,59 @@
+//
+//  BackupVfs.h
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+
+#ifndef BackupVfs_h
+#define BackupVfs_h
+
+#include <string>
+#include <cstdint>
+
+struct sqlite3_vfs;
+class ITunesDb;
+
+// Read-only SQLite VFS over the files of a backup, registered under a name of its own (getName) while it lives
+// A database is opened by its relativePath in the backup, which is resolved to the hashed file of ITunesDb, or by its real path,
+// so the names need no URI encoding
+// Up to SqliteReadProfile::maxMmapSize bytes of the main database are mapped into memory: SQLite fetches those pages
+// from the mapping without copies if mmap_size is set, and sequential reads get the next pages prefetched;
+// the rest of the file (or all of it if maxMmapSize is 0) is read through the page cache
+// The file is immutable to SQLite (no locks, no journal)
+// Other files (temporary files, journals) go to the default VFS
+class BackupVfs
+{
+public:
+    // Bytes which are prefetched ahead of sequential reads
+    static const uint64_t READAHEAD_SIZE = 2 * 1024 * 1024;
+
+protected:
+    sqlite3_vfs* m_vfs;
+    sqlite3_vfs* m_parent;
+    std::string m_name;
+    const ITunesDb* m_iTunesDb;
+
+public:
+    // iTunesDb resolves the relative paths, it can be NULL for real paths only
+    explicit BackupVfs(const ITunesDb* iTunesDb);
+    ~BackupVfs();
+
+    // NULL if SQLite can't register it
+    const char* getName() const;
+
+    sqlite3_vfs* getParent() const
+    {
+        return m_parent;
+    }
+
+    // The real path of a relativePath in the backup, or the name itself
+    std::string resolvePath(const std::string& name) const;
+
+private:
+    BackupVfs(const BackupVfs&);
+    BackupVfs& operator=(const BackupVfs&);
+};
+
+#endif /* BackupVfs_h */
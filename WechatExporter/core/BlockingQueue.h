@@ -0,0 +1,86 @@
+//
+//  BlockingQueue.h
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+
+#ifndef BlockingQueue_h
+#define BlockingQueue_h
+
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+
+// Bounded FIFO shared by the producer/consumer stages of the exporting pipeline
+// push() blocks while the queue is full, pop() blocks while it is empty
+// After close(), push() fails and pop() returns the remaining items and then fails
+template<class T>
+class BlockingQueue
+{
+protected:
+    std::queue<T> m_queue;
+    size_t m_capacity;
+    bool m_closed;
+    mutable std::mutex m_mtx;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+
+public:
+    BlockingQueue(size_t capacity) : m_capacity(capacity == 0 ? 1 : capacity), m_closed(false)
+    {
+    }
+
+    bool push(T&& item)
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        while (!m_closed && m_queue.size() >= m_capacity)
+        {
+            m_notFull.wait(lock);
+        }
+        if (m_closed)
+        {
+            return false;
+        }
+        m_queue.push(std::move(item));
+        lock.unlock();
+        m_notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        while (!m_closed && m_queue.empty())
+        {
+            m_notEmpty.wait(lock);
+        }
+        if (m_queue.empty())
+        {
+            return false;
+        }
+        item = std::move(m_queue.front());
+        m_queue.pop();
+        lock.unlock();
+        m_notFull.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_closed = true;
+        lock.unlock();
+        m_notEmpty.notify_all();
+        m_notFull.notify_all();
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_queue.size();
+    }
+};
+
+#endif /* BlockingQueue_h */
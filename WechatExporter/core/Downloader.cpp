@@ -14,6 +14,7 @@
 #include <sys/stat.h>
 #include "OSDef.h"
 #include "Utils.h"
+#include "ExportJournal.h"
 #ifdef _WIN32
 #include <atlstr.h>
 #endif
@@ -34,9 +35,31 @@ unsigned int Task::getRetries() const
     return m_retries;
 }
 
-bool Task::run()
+bool Task::run(const FileCopier& fileCopier)
 {
-    return m_localCopy ? copyFile() : downloadFile();
+    if (m_localCopy)
+    {
+        return copyFile(fileCopier);
+    }
+    if (fileCopier.isSkippingUnchanged() && isDownloaded())
+    {
+        return true;
+    }
+    return downloadFile();
+}
+
+bool Task::isDownloaded() const
+{
+    // The file is renamed from the .tmp one after it is downloaded completely
+    // Only the mtime of the message tells the file is the same one, e.g.: avatars are queued with 0 and their urls
+    // point to the latest portraits, so they are always downloaded again
+    if (m_mtime <= 0)
+    {
+        return false;
+    }
+    uint64_t size = 0;
+    time_t mtime = 0;
+    return getFileSizeAndTime(m_output, size, mtime) && size > 0 && mtime == m_mtime;
 }
 
 bool Task::downloadFile()
@@ -104,9 +127,13 @@ bool Task::downloadFile()
     return res == CURLE_OK;
 }
 
-bool Task::copyFile()
+bool Task::copyFile(const FileCopier& fileCopier)
 {
-	return ::copyFile(m_url, m_output);
+    if (m_linkable && fileCopier.linkFile(m_url, m_output))
+    {
+        return true;
+    }
+	return fileCopier.copyFile(m_url, m_output, m_mtime);
 }
 
 size_t Task::writeData(void *buffer, size_t size, size_t nmemb)
@@ -119,7 +146,7 @@ size_t Task::writeData(void *buffer, size_t size, size_t nmemb)
 	return 0;
 }
 
-Downloader::Downloader(Logger* logger) : m_logger(logger)
+Downloader::Downloader(Logger* logger) : m_linkingDuplicates(false), m_journal(NULL), m_logger(logger)
 {
     m_noMoreTask = false;
     m_downloadTaskSize = 0;
@@ -137,6 +164,26 @@ void Downloader::setUserAgent(const std::string& userAgent)
     m_userAgent = userAgent;
 }
 
+void Downloader::setLinkingFiles(bool linkingFiles)
+{
+    m_fileCopier.setLinkingFiles(linkingFiles);
+}
+
+void Downloader::setSkippingUnchanged(bool skippingUnchanged)
+{
+    m_fileCopier.setSkippingUnchanged(skippingUnchanged);
+}
+
+void Downloader::setLinkingDuplicates(bool linkingDuplicates)
+{
+    m_linkingDuplicates = linkingDuplicates;
+}
+
+void Downloader::setJournal(ExportJournal* journal)
+{
+    m_journal = journal;
+}
+
 void Downloader::addTask(const std::string &url, const std::string& output, time_t mtime)
 {
 #ifndef NDEBUG
@@ -145,6 +192,11 @@ void Downloader::addTask(const std::string &url, const std::string& output, time
         int aa = 0;
     }
 #endif
+    std::string formatedPath = output;
+    std::replace(formatedPath.begin(), formatedPath.end(), DIR_SEP_R, DIR_SEP);
+    bool existed = false;
+    bool queued = false;
+    
     m_mtx.lock();
     if (m_threads.empty())
     {
@@ -153,18 +205,17 @@ void Downloader::addTask(const std::string &url, const std::string& output, time
             m_threads.push_back(std::thread(&Downloader::run, this, idx));
         }
     }
-    m_mtx.unlock();
     
-    std::string formatedPath = output;
-    std::replace(formatedPath.begin(), formatedPath.end(), DIR_SEP_R, DIR_SEP);
-    std::string uid = url + output;
-    bool existed = false;
-    
-    m_mtx.lock();
-    if (startsWith(url, "file://"))
+    if (!m_outputs.insert(formatedPath).second)
+    {
+        // The file is already going to be downloaded or copied
+        existed = true;
+    }
+    else if (startsWith(url, "file://"))
     {
         Task task(url.substr(7), formatedPath, mtime, true);
         m_copyQueue.push(task);
+        queued = true;
     }
     else
     {
@@ -178,16 +229,22 @@ void Downloader::addTask(const std::string &url, const std::string& output, time
             task.setUserAgent(m_userAgent);
             m_queue.push(task);
             m_downloadTaskSize++;
+            queued = true;
         }
         else if (output != it->second)
         {
-            Task task(it->second, formatedPath, mtime, true);
+            Task task(it->second, formatedPath, mtime, true, m_linkingDuplicates);
             m_copyQueue.push(task);
+            queued = true;
         }
     }
 
     m_mtx.unlock();
     
+    if (queued && NULL != m_journal)
+    {
+        m_journal->downloadQueued(url, formatedPath, mtime);
+    }
     if (existed)
     {
 #ifndef NDEBUG
@@ -244,7 +301,11 @@ void Downloader::run(int idx)
                 // m_logger->debug(log);
             }
 #endif
-            bool succeeded = task.run();
+            bool succeeded = task.run(m_fileCopier);
+            if (succeeded && NULL != m_journal)
+            {
+                m_journal->downloadCompleted(task.getOutput());
+            }
             if (!task.isLocalCopy())
             {
                 m_mtx.lock();
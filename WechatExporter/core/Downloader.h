@@ -13,10 +13,14 @@
 #include <string>
 #include <queue>
 #include <map>
+#include <set>
 #include <utility>
 #include <thread>
 #include <mutex>
 #include "Logger.h"
+#include "FileCopier.h"
+
+class ExportJournal;
 
 class Task
 {
@@ -28,15 +32,16 @@ protected:
     std::string m_userAgent;
     time_t m_mtime;
     bool m_localCopy;
+    bool m_linkable;    // The source is in the output, a link can replace the copy
     unsigned int m_retries;
 public:
     static const unsigned int MAX_RETRIES = 3;
 public:
-    Task() : m_localCopy(false)
+    Task() : m_localCopy(false), m_linkable(false)
     {
     }
     
-    Task(const std::string &url, const std::string& output, time_t mtime, bool localCopy = false) : m_url(url), m_output(output), m_mtime(mtime), m_localCopy(localCopy), m_retries(0)
+    Task(const std::string &url, const std::string& output, time_t mtime, bool localCopy = false, bool linkable = false) : m_url(url), m_output(output), m_mtime(mtime), m_localCopy(localCopy), m_linkable(linkable), m_retries(0)
     {
     }
     
@@ -73,6 +78,7 @@ public:
             m_output = task.m_output;
             m_mtime = task.m_mtime;
             m_localCopy = task.m_localCopy;
+            m_linkable = task.m_linkable;
             m_retries = task.m_retries;
         }
         
@@ -80,12 +86,13 @@ public:
     }
     
     size_t writeData(void *buffer, size_t size, size_t nmemb);
-    bool run();
+    bool run(const FileCopier& fileCopier);
     unsigned int getRetries() const;
     
 protected:
     bool downloadFile();
-    bool copyFile();
+    bool copyFile(const FileCopier& fileCopier);
+    bool isDownloaded() const;
 };
 
 class Downloader
@@ -94,11 +101,15 @@ protected:
     std::queue<Task> m_queue;
     std::queue<Task> m_copyQueue;
     std::map<std::string, std::string> m_urls;  // url => local file path for first download
+    std::set<std::string> m_outputs;            // Local file paths which are queued, a file is written only once
     mutable std::mutex m_mtx;
     bool m_noMoreTask;
     unsigned m_downloadTaskSize;    // +1 when task is added, -1 when download is completed
     std::vector<std::thread> m_threads;
     std::string m_userAgent;
+    FileCopier m_fileCopier;
+    bool m_linkingDuplicates;
+    ExportJournal* m_journal;
     
     Logger* m_logger;
     
@@ -107,6 +118,14 @@ public:
     ~Downloader();
     
     void setUserAgent(const std::string& userAgent);
+    // Link the local files instead of copying them
+    void setLinkingFiles(bool linkingFiles);
+    // Keep the files which the previous export downloaded or copied
+    void setSkippingUnchanged(bool skippingUnchanged);
+    // Link the outputs of the same url to the first download instead of copying it
+    void setLinkingDuplicates(bool linkingDuplicates);
+    // Record the queued and completed tasks, so the pending ones can be queued again if the export is resumed
+    void setJournal(ExportJournal* journal);
     
     void addTask(const std::string &url, const std::string& output, time_t mtime);
     void setNoMoreTask();
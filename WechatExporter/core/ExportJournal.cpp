@@ -0,0 +1,185 @@
+//
+//  ExportJournal.cpp
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+
+#include "ExportJournal.h"
+#include <vector>
+#include <cstdlib>
+#ifdef _WIN32
+#include <atlstr.h>
+#endif
+#include "Utils.h"
+
+ExportJournal::ExportJournal() : m_file(NULL)
+{
+}
+
+ExportJournal::~ExportJournal()
+{
+    close(false);
+}
+
+bool ExportJournal::open(const std::string& path, int options, const std::string& filter, const std::string& extName, bool resuming)
+{
+    close(false);
+
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_path = path;
+    m_sessions.clear();
+    m_pendingDownloads.clear();
+
+    std::string header = "H\t" + std::to_string(VERSION) + "\t" + std::to_string(options) + "\t" + filter + "\t" + extName;
+    if (resuming)
+    {
+        load(header);
+    }
+    bool appending = resuming && (!m_sessions.empty() || !m_pendingDownloads.empty());
+
+#ifdef _WIN32
+    CA2W pszW(path.c_str(), CP_UTF8);
+    m_file = _wfopen(pszW, appending ? L"ab" : L"wb");
+#else
+    m_file = fopen(path.c_str(), appending ? "ab" : "wb");
+#endif
+    if (NULL == m_file)
+    {
+        return false;
+    }
+    if (!appending)
+    {
+        fputs((header + "\n").c_str(), m_file);
+        fflush(m_file);
+    }
+
+    // Partial downloads of the previous run, which are downloaded again
+    for (std::map<std::string, JournalDownload>::const_iterator it = m_pendingDownloads.cbegin(); it != m_pendingDownloads.cend(); ++it)
+    {
+        deleteFile(it->first + ".tmp");
+    }
+    return true;
+}
+
+void ExportJournal::close(bool finished)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (NULL != m_file)
+    {
+        fclose(m_file);
+        m_file = NULL;
+        if (finished)
+        {
+            deleteFile(m_path);
+        }
+    }
+}
+
+bool ExportJournal::findCompletedSession(const std::string& usrName, JournalSession& session) const
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    std::map<std::string, JournalSession>::const_iterator it = m_sessions.find(usrName);
+    if (it == m_sessions.cend())
+    {
+        return false;
+    }
+    session = it->second;
+    return true;
+}
+
+void ExportJournal::sessionStarted(const std::string& usrName)
+{
+    append("s\t" + usrName);
+}
+
+void ExportJournal::sessionCompleted(const std::string& usrName, int count, const ExportedSession& exported)
+{
+    append("S\t" + usrName + "\t" + std::to_string(count) + "\t" + exported.outputFileName + "\t" + std::to_string(exported.lastMsgId) + "\t" + std::to_string(exported.lastCreateTime) + "\t" +
+           std::to_string(exported.layout.pageSize) + "\t" + std::to_string(exported.layout.numberOfMessages) + "\t" + std::to_string(exported.layout.numberOfShards) + "\t" + std::to_string(exported.layout.numberOfMessagesInLastShard) + "\t" +
+           std::to_string(exported.layout.lastShardLength));
+}
+
+void ExportJournal::downloadQueued(const std::string& url, const std::string& output, time_t mtime)
+{
+    append("D\t" + output + "\t" + url + "\t" + std::to_string(static_cast<long long>(mtime)));
+}
+
+void ExportJournal::downloadCompleted(const std::string& output)
+{
+    append("d\t" + output);
+}
+
+void ExportJournal::load(const std::string& header)
+{
+    std::string data = readFile(m_path);
+    std::vector<std::string> lines = split(data, "\n");
+    if (lines.empty() || lines[0] != header)
+    {
+        return;
+    }
+
+    for (std::vector<std::string>::const_iterator it = lines.cbegin() + 1; it != lines.cend(); ++it)
+    {
+        // A record which is cut by the crash has fewer fields and is ignored
+        std::vector<std::string> fields = split(*it, "\t");
+        if (fields.empty() || fields[0].size() != 1)
+        {
+            continue;
+        }
+        switch (fields[0][0])
+        {
+            case 's':
+                if (fields.size() == 2)
+                {
+                    // Started again, the previous completion doesn't count
+                    m_sessions.erase(fields[1]);
+                }
+                break;
+            case 'S':
+                if (fields.size() == 11)
+                {
+                    JournalSession& session = m_sessions[fields[1]];
+                    session.count = std::atoi(fields[2].c_str());
+                    session.exported.outputFileName = fields[3];
+                    session.exported.extName = header.substr(header.find_last_of('\t') + 1);
+                    session.exported.lastMsgId = std::atoi(fields[4].c_str());
+                    session.exported.lastCreateTime = std::atoi(fields[5].c_str());
+                    session.exported.layout.pageSize = std::strtoul(fields[6].c_str(), NULL, 10);
+                    session.exported.layout.numberOfMessages = std::strtoul(fields[7].c_str(), NULL, 10);
+                    session.exported.layout.numberOfShards = static_cast<unsigned int>(std::strtoul(fields[8].c_str(), NULL, 10));
+                    session.exported.layout.numberOfMessagesInLastShard = std::strtoul(fields[9].c_str(), NULL, 10);
+                    session.exported.layout.lastShardLength = static_cast<size_t>(std::strtoull(fields[10].c_str(), NULL, 10));
+                }
+                break;
+            case 'D':
+                if (fields.size() == 4)
+                {
+                    JournalDownload& download = m_pendingDownloads[fields[1]];
+                    download.url = fields[2];
+                    download.mtime = static_cast<time_t>(std::atoll(fields[3].c_str()));
+                }
+                break;
+            case 'd':
+                if (fields.size() == 2)
+                {
+                    m_pendingDownloads.erase(fields[1]);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void ExportJournal::append(const std::string& record)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (NULL != m_file)
+    {
+        fputs(record.c_str(), m_file);
+        fputc('\n', m_file);
+        fflush(m_file);
+    }
+}
@@ -0,0 +1,90 @@
+//
+//  ExportJournal.h
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+
+#ifndef ExportJournal_h
+#define ExportJournal_h
+
+#include <stdio.h>
+#include <string>
+#include <map>
+#include <mutex>
+#include <ctime>
+#include "ExportManifest.h"
+
+struct JournalSession
+{
+    int count;                  // Messages of the session, for the list page
+    ExportedSession exported;
+
+    JournalSession() : count(0)
+    {
+    }
+};
+
+struct JournalDownload
+{
+    std::string url;
+    time_t mtime;
+
+    JournalDownload() : mtime(0)
+    {
+    }
+};
+
+// Append-only log of an export of an account, <account>/export_journal.log, one record per line, tab-separated:
+//   H  version options filter extName  header, the journal is only resumed with the same options and filter
+//   s  usrName                         session started
+//   S  usrName count file lastMsgId lastCreateTime pageSize messages pages lastPageMessages lastPageLength
+//                                      session completed, its pages are renamed to the final names already
+//   D  output url mtime                download or local copy queued
+//   d  output                          download or local copy completed
+// Every record is flushed, so the journal survives the process which is killed or cancelled,
+// and the next run in resume mode skips the completed sessions and queues the pending downloads again
+// The journal is deleted when the export of the account completes, and only kept for a resumable export (Exporter::setResuming)
+// Partial downloads (<output>.tmp) are deleted on resuming, partial copies get the modified time
+// of the source only after the data is written, so neither is taken as complete
+// Thread-safe
+class ExportJournal
+{
+protected:
+    std::string m_path;
+    FILE* m_file;
+    mutable std::mutex m_mtx;
+
+    std::map<std::string, JournalSession> m_sessions;           // usrName => completed session
+    std::map<std::string, JournalDownload> m_pendingDownloads;  // output => download
+
+public:
+    static const int VERSION = 2;
+
+    ExportJournal();
+    ~ExportJournal();
+
+    // filter: ExportManifest::formatFilter
+    // resuming: read the records of the previous run if it has the same header, otherwise the journal is started over
+    bool open(const std::string& path, int options, const std::string& filter, const std::string& extName, bool resuming);
+    // finished: the export of the account completes and the journal is deleted
+    void close(bool finished);
+
+    bool findCompletedSession(const std::string& usrName, JournalSession& session) const;
+    const std::map<std::string, JournalDownload>& getPendingDownloads() const
+    {
+        return m_pendingDownloads;
+    }
+
+    void sessionStarted(const std::string& usrName);
+    void sessionCompleted(const std::string& usrName, int count, const ExportedSession& exported);
+    void downloadQueued(const std::string& url, const std::string& output, time_t mtime);
+    void downloadCompleted(const std::string& output);
+
+protected:
+    void load(const std::string& header);
+    void append(const std::string& record);
+};
+
+#endif /* ExportJournal_h */
@@ -0,0 +1,141 @@
+//
+//  ExportManifest.cpp
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+
+#include "ExportManifest.h"
+#include <set>
+#include <json/json.h>
+#include "Utils.h"
+#include "WechatObjects.h"
+
+static void appendFilterValue(int value, std::string& filter)
+{
+    filter += std::to_string(value);
+}
+
+static void appendFilterValue(const std::string& value, std::string& filter)
+{
+    filter += value;
+}
+
+template<class T>
+static void appendFilterValues(const char* name, const std::set<T>& values, std::string& filter)
+{
+    if (values.empty())
+    {
+        return;
+    }
+    filter += name;
+    for (typename std::set<T>::const_iterator it = values.cbegin(); it != values.cend(); ++it)
+    {
+        filter += (it == values.cbegin()) ? "=" : ",";
+        appendFilterValue(*it, filter);
+    }
+    filter += ";";
+}
+
+std::string ExportManifest::formatFilter(const MessageFilter& filter)
+{
+    if (filter.isEmpty())
+    {
+        return std::string();
+    }
+    std::string result = "time=" + std::to_string(filter.startTime) + "-" + std::to_string(filter.endTime) + ";";
+    appendFilterValues("types", filter.types, result);
+    appendFilterValues("excludedTypes", filter.excludedTypes, result);
+    appendFilterValues("senders", filter.senders, result);
+    return result;
+}
+
+bool ExportManifest::load(const std::string& path)
+{
+    m_path = path;
+    m_sessions.clear();
+
+    Json::Reader reader;
+    Json::Value root;
+    if (!reader.parse(readFile(path), root) || !root.isObject() || root["version"].asInt() != VERSION)
+    {
+        return false;
+    }
+
+    const Json::Value& sessions = root["sessions"];
+    if (!sessions.isObject())
+    {
+        return false;
+    }
+    for (Json::Value::const_iterator it = sessions.begin(); it != sessions.end(); ++it)
+    {
+        const Json::Value& value = *it;
+        ExportedSession& session = m_sessions[it.name()];
+        session.outputFileName = value["file"].asString();
+        session.extName = value["ext"].asString();
+        session.lastMsgId = value["lastMsgId"].asInt();
+        session.lastCreateTime = value["lastCreateTime"].asInt();
+        session.desc = value["desc"].asBool();
+        session.filter = value["filter"].asString();
+        session.layout.pageSize = value["pageSize"].asUInt();
+        session.layout.numberOfMessages = value["messages"].asUInt();
+        session.layout.numberOfShards = value["pages"].asUInt();
+        session.layout.numberOfMessagesInLastShard = value["lastPageMessages"].asUInt();
+        session.layout.lastShardLength = static_cast<size_t>(value["lastPageLength"].asUInt64());
+    }
+    return true;
+}
+
+bool ExportManifest::save() const
+{
+    Json::Value root(Json::objectValue);
+    root["version"] = VERSION;
+    Json::Value& sessions = root["sessions"];
+    sessions = Json::Value(Json::objectValue);
+    for (std::map<std::string, ExportedSession>::const_iterator it = m_sessions.cbegin(); it != m_sessions.cend(); ++it)
+    {
+        Json::Value& value = sessions[it->first];
+        value["file"] = it->second.outputFileName;
+        value["ext"] = it->second.extName;
+        value["lastMsgId"] = it->second.lastMsgId;
+        value["lastCreateTime"] = it->second.lastCreateTime;
+        value["desc"] = it->second.desc;
+        value["filter"] = it->second.filter;
+        value["pageSize"] = static_cast<Json::UInt>(it->second.layout.pageSize);
+        value["messages"] = static_cast<Json::UInt>(it->second.layout.numberOfMessages);
+        value["pages"] = it->second.layout.numberOfShards;
+        value["lastPageMessages"] = static_cast<Json::UInt>(it->second.layout.numberOfMessagesInLastShard);
+        value["lastPageLength"] = static_cast<Json::UInt64>(it->second.layout.lastShardLength);
+    }
+
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    std::string tmpPath = m_path + ".tmp";
+    if (!writeFile(tmpPath, Json::writeString(builder, root)))
+    {
+        return false;
+    }
+    return replaceFile(tmpPath, m_path);
+}
+
+bool ExportManifest::getSession(const std::string& usrName, ExportedSession& session) const
+{
+    std::map<std::string, ExportedSession>::const_iterator it = m_sessions.find(usrName);
+    if (it == m_sessions.cend())
+    {
+        return false;
+    }
+    session = it->second;
+    return true;
+}
+
+void ExportManifest::setSession(const std::string& usrName, const ExportedSession& session)
+{
+    m_sessions[usrName] = session;
+}
+
+void ExportManifest::removeSession(const std::string& usrName)
+{
+    m_sessions.erase(usrName);
+}
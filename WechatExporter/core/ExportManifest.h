@@ -0,0 +1,60 @@
+//
+//  ExportManifest.h
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+
+#ifndef ExportManifest_h
+#define ExportManifest_h
+
+#include <string>
+#include <map>
+#include "SessionPageWriter.h"
+
+struct MessageFilter;
+
+// What the previous export wrote for a session: the last message and where its pages stop
+struct ExportedSession
+{
+    std::string outputFileName;
+    std::string extName;
+    int lastMsgId;          // MesLocalID
+    int lastCreateTime;
+    bool desc;              // Newer messages can only be appended to the ascending pages
+    std::string filter;     // ExportManifest::formatFilter, the filtered-out messages are never appended
+    SessionPageLayout layout;
+
+    ExportedSession() : lastMsgId(0), lastCreateTime(0), desc(false)
+    {
+    }
+};
+
+// <account>/export_manifest.json, which incremental export continues from:
+// {"version": 2, "sessions": {"<usrName>": {"file": "...", "ext": "html", "lastMsgId": 123, "lastCreateTime": 1600000000, "desc": false, "filter": "",
+//   "pageSize": 1000, "messages": 12345, "pages": 12, "lastPageMessages": 345, "lastPageLength": 123456}}}
+// It's saved after every session, so the layout on disk never runs ahead of it by more than the session being exported
+class ExportManifest
+{
+protected:
+    std::string m_path;
+    std::map<std::string, ExportedSession> m_sessions;
+
+public:
+    static const int VERSION = 2;
+
+    // Text form of the filter, empty for no filter, without tabs or line breaks
+    static std::string formatFilter(const MessageFilter& filter);
+
+    // False if there is no manifest or it can't be used, the manifest is empty then
+    bool load(const std::string& path);
+    // Written to a temporary file and renamed, so a manifest is always complete
+    bool save() const;
+
+    bool getSession(const std::string& usrName, ExportedSession& session) const;
+    void setSession(const std::string& usrName, const ExportedSession& session);
+    void removeSession(const std::string& usrName);
+};
+
+#endif /* ExportManifest_h */
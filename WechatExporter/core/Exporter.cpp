@@ -10,6 +10,9 @@
 #include <json/json.h>
 #include "Downloader.h"
 #include "WechatParser.h"
+#include "SessionPageWriter.h"
+#include "ExportManifest.h"
+#include "ExportJournal.h"
 
 struct FriendDownloadHandler
 {
@@ -103,6 +106,65 @@ void Exporter::saveFilesInSessionFolder(bool flag/* = true*/)
         m_options &= ~SPO_ICON_IN_SESSION;
 }
 
+void Exporter::setPagedOutput(bool paged/* = true*/)
+{
+    if (paged)
+        m_options |= SPO_PAGED_OUTPUT;
+    else
+        m_options &= ~SPO_PAGED_OUTPUT;
+}
+
+void Exporter::linkFilesToBackup(bool flag/* = true*/)
+{
+    if (flag)
+        m_options |= SPO_LINK_FILES;
+    else
+        m_options &= ~SPO_LINK_FILES;
+}
+
+void Exporter::shareAssets(bool flag/* = true*/)
+{
+    if (flag)
+        m_options |= SPO_SHARED_ASSETS;
+    else
+        m_options &= ~SPO_SHARED_ASSETS;
+}
+
+void Exporter::setOverwritingFiles(bool flag/* = true*/)
+{
+    if (flag)
+        m_options |= SPO_OVERWRITE_FILES;
+    else
+        m_options &= ~SPO_OVERWRITE_FILES;
+}
+
+void Exporter::setIncrementalExport(bool incremental/* = true*/)
+{
+    if (incremental)
+    {
+        // Only the shards of paged output in ascending order can be appended
+        m_options |= SPO_INCREMENTAL | SPO_PAGED_OUTPUT;
+        m_options &= ~SPO_DESC;
+    }
+    else
+    {
+        m_options &= ~SPO_INCREMENTAL;
+    }
+}
+
+void Exporter::setResuming(bool resuming/* = true*/)
+{
+    if (resuming)
+        m_options |= SPO_RESUME;
+    else
+        m_options &= ~SPO_RESUME;
+}
+
+void Exporter::setDatabaseProfile(const SqliteReadProfile& profile)
+{
+    setSqliteReadProfile(profile);
+}
+
 void Exporter::setExtName(const std::string& extName)
 {
     m_extName = extName;
@@ -118,6 +180,11 @@ void Exporter::filterUsersAndSessions(const std::map<std::string, std::set<std::
     m_usersAndSessions = usersAndSessions;
 }
 
+void Exporter::filterMessages(const MessageFilter& filter)
+{
+    m_messageFilter = filter;
+}
+
 bool Exporter::run()
 {
     if (isRunning() || m_thread.joinable())
@@ -243,27 +310,29 @@ bool Exporter::runImpl()
         std::string userOutputPath;
         exportUser(*it, userOutputPath);
         
-        std::string userItem = getTemplate("listitem");
-        userItem = replaceAll(userItem, "%%ITEMPICPATH%%", userOutputPath + "/Portrait/" + it->getLocalPortrait());
+        TemplateValues itemValues("listitem");
+        itemValues[TK_ITEMPICPATH] = userOutputPath + "/Portrait/" + it->getLocalPortrait();
         if ((m_options & SPO_IGNORE_HTML_ENC) == 0)
         {
-            userItem = replaceAll(userItem, "%%ITEMLINK%%", encodeUrl(it->getOutputFileName()) + "/index." + m_extName);
-            userItem = replaceAll(userItem, "%%ITEMTEXT%%", safeHTML(it->getDisplayName()));
+            itemValues[TK_ITEMLINK] = encodeUrl(it->getOutputFileName()) + "/index." + m_extName;
+            itemValues[TK_ITEMTEXT] = safeHTML(it->getDisplayName());
         }
         else
         {
-            userItem = replaceAll(userItem, "%%ITEMLINK%%", it->getOutputFileName() + "/index." + m_extName);
-            userItem = replaceAll(userItem, "%%ITEMTEXT%%", it->getDisplayName());
+            itemValues[TK_ITEMLINK] = it->getOutputFileName() + "/index." + m_extName;
+            itemValues[TK_ITEMTEXT] = it->getDisplayName();
         }
         
-        htmlBody += userItem;
+        getTemplate(itemValues.getName()).render(itemValues, htmlBody);
     }
     
     std::string fileName = combinePath(m_output, "index." + m_extName);
 
-    std::string html = getTemplate("listframe");
-    html = replaceAll(html, "%%USERNAME%%", "");
-    html = replaceAll(html, "%%TBODY%%", htmlBody);
+    TemplateValues frameValues("listframe");
+    frameValues[TK_USERNAME] = "";
+    frameValues[TK_TBODY].swap(htmlBody);
+    std::string html;
+    getTemplate(frameValues.getName()).render(frameValues, html);
     
     writeFile(fileName, html);
     
@@ -314,7 +383,9 @@ bool Exporter::exportUser(Friend& user, std::string& userOutputPath)
         std::string portraitPath = combinePath(outputBase, "Portrait");
         m_shell->makeDirectory(portraitPath);
         std::string defaultPortrait = combinePath(portraitPath, "DefaultProfileHead@2x.png");
-        m_shell->copyFile(combinePath(m_workDir, "res", "DefaultProfileHead@2x.png"), defaultPortrait, true);
+        FileCopier fileCopier;
+        fileCopier.setLinkingFiles((m_options & SPO_LINK_FILES) == SPO_LINK_FILES);
+        fileCopier.copyFile(combinePath(m_workDir, "res", "DefaultProfileHead@2x.png"), defaultPortrait, 0);
     }
     if ((m_options & SPO_ICON_IN_SESSION) == 0 && (m_options & SPO_IGNORE_EMOJI) == 0)
     {
@@ -353,11 +424,30 @@ bool Exporter::exportUser(Friend& user, std::string& userOutputPath)
     
     std::function<std::string(const std::string&)> localeFunction = std::bind(&Exporter::getLocaleString, this, std::placeholders::_1);
 
+    // The journal outlives the downloader, which records the tasks in it until it exits
+    // It's only written for a resumable export, a journal which isn't opened records nothing
+    std::string filter = ExportManifest::formatFilter(m_messageFilter);
+    bool resumable = (m_options & SPO_RESUME) == SPO_RESUME;
+    ExportJournal journal;
+    if (resumable && !journal.open(combinePath(outputBase, "export_journal.log"), m_options & ~SPO_RESUME, filter, m_extName, true))
+    {
+        m_logger->write(formatString(getLocaleString("Failed to write file: %s"), combinePath(outputBase, "export_journal.log").c_str()));
+    }
+    
     Downloader downloader(m_logger);
 #ifndef NDEBUG
     m_logger->debug("UA: " + m_wechatInfo.buildUserAgent());
 #endif
     downloader.setUserAgent(m_wechatInfo.buildUserAgent());
+    downloader.setLinkingFiles((m_options & SPO_LINK_FILES) == SPO_LINK_FILES);
+    downloader.setLinkingDuplicates((m_options & SPO_SHARED_ASSETS) == SPO_SHARED_ASSETS);
+    downloader.setSkippingUnchanged((m_options & SPO_OVERWRITE_FILES) == 0);
+    downloader.setJournal(resumable ? &journal : NULL);
+    const std::map<std::string, JournalDownload>& pendingDownloads = journal.getPendingDownloads();
+    for (std::map<std::string, JournalDownload>::const_iterator it = pendingDownloads.cbegin(); it != pendingDownloads.cend(); ++it)
+    {
+        downloader.addTask(it->second.url, it->first, it->second.mtime);
+    }
     if ((m_options & SPO_IGNORE_AVATAR) == 0)
     {
 #ifndef NDEBUG
@@ -367,6 +457,11 @@ bool Exporter::exportUser(Friend& user, std::string& userOutputPath)
     }
     
     SessionParser sessionParser(*myself, friends, *m_iTunesDb, *m_shell, m_options, downloader, localeFunction);
+    sessionParser.setMessageFilter(m_messageFilter);
+    // Saved after every session, so a killed export never leaves pages which are ahead of the manifest of their session
+    bool paged = (m_options & SPO_TEXT_MODE) != SPO_TEXT_MODE && (m_options & SPO_PAGED_OUTPUT) == SPO_PAGED_OUTPUT;
+    ExportManifest manifest;
+    manifest.load(combinePath(outputBase, "export_manifest.json"));
     std::set<std::string> sessionFileNames;
     for (std::vector<Session>::iterator it = sessions.begin(); it != sessions.end(); ++it)
     {
@@ -407,32 +502,89 @@ bool Exporter::exportUser(Friend& user, std::string& userOutputPath)
                 downloader.addTask(it->getPortrait(), combinePath(outputBase, "Portrait", it->getLocalPortrait()), 0);
             }
         }
-        int count = exportSession(*myself, sessionParser, *it, userBase, outputBase);
+        int count = 0;
+        JournalSession completed;
+        if (journal.findCompletedSession(it->getUsrName(), completed) && completed.exported.outputFileName == it->getOutputFileName())
+        {
+            // Completed by the interrupted export, its pages and media files are all written
+            count = completed.count;
+            if (completed.exported.layout.pageSize > 0)
+            {
+                // The journal is only resumed with the same options and filter
+                completed.exported.desc = (m_options & SPO_DESC) == SPO_DESC;
+                completed.exported.filter = filter;
+                manifest.setSession(it->getUsrName(), completed.exported);
+                manifest.save();
+            }
+        }
+        else
+        {
+            journal.sessionStarted(it->getUsrName());
+            count = exportSession(*myself, sessionParser, *it, userBase, outputBase, manifest);
+            // An incomplete session isn't journaled, so a resumed export does it again
+            if (!m_cancelled && count >= 0)
+            {
+                if (!manifest.getSession(it->getUsrName(), completed.exported))
+                {
+                    completed.exported = ExportedSession();
+                    completed.exported.outputFileName = it->getOutputFileName();
+                    completed.exported.extName = m_extName;
+                }
+                journal.sessionCompleted(it->getUsrName(), count, completed.exported);
+            }
+            if (paged)
+            {
+                manifest.save();
+            }
+        }
         
+        if (count < 0)
+        {
+            m_logger->write(formatString(getLocaleString("Failed to read all messages of the chat: %s"), sessionDisplayName.c_str()));
+            continue;
+        }
         m_logger->write(formatString(getLocaleString("Succeeded handling %d messages."), count));
         
         if (count > 0)
         {
-            std::string userItem = getTemplate("listitem");
-            userItem = replaceAll(userItem, "%%ITEMPICPATH%%", "Portrait/" + it->getLocalPortrait());
+            TemplateValues itemValues("listitem");
+            itemValues[TK_ITEMPICPATH] = "Portrait/" + it->getLocalPortrait();
             if ((m_options & SPO_IGNORE_HTML_ENC) == 0)
             {
-                userItem = replaceAll(userItem, "%%ITEMLINK%%", encodeUrl(it->getOutputFileName()) + "." + m_extName);
-                userItem = replaceAll(userItem, "%%ITEMTEXT%%", safeHTML(sessionDisplayName));
+                itemValues[TK_ITEMLINK] = encodeUrl(it->getOutputFileName()) + "." + m_extName;
+                itemValues[TK_ITEMTEXT] = safeHTML(sessionDisplayName);
             }
             else
             {
-                userItem = replaceAll(userItem, "%%ITEMLINK%%", it->getOutputFileName() + "." + m_extName);
-                userItem = replaceAll(userItem, "%%ITEMTEXT%%", sessionDisplayName);
+                itemValues[TK_ITEMLINK] = it->getOutputFileName() + "." + m_extName;
+                itemValues[TK_ITEMTEXT] = sessionDisplayName;
             }
             
-            userBody += userItem;
+            getTemplate(itemValues.getName()).render(itemValues, userBody);
         }
     }
 
-    std::string html = getTemplate("listframe");
-    html = replaceAll(html, "%%USERNAME%%", " - " + user.getDisplayName());
-    html = replaceAll(html, "%%TBODY%%", userBody);
+    std::string copyStatistics = sessionParser.getFileCopier().getStatistics();
+    if (!copyStatistics.empty())
+    {
+        m_logger->debug("Copied files: " + copyStatistics);
+    }
+    std::string readerStatistics = sessionParser.getReaderStatistics();
+    if (!readerStatistics.empty())
+    {
+        m_logger->debug("Read messages: " + readerStatistics);
+    }
+    std::string audioStatistics = sessionParser.getAudioStatistics();
+    if (!audioStatistics.empty())
+    {
+        m_logger->debug("Converted audio: " + audioStatistics);
+    }
+
+    TemplateValues frameValues("listframe");
+    frameValues[TK_USERNAME] = " - " + user.getDisplayName();
+    frameValues[TK_TBODY].swap(userBody);
+    std::string html;
+    getTemplate(frameValues.getName()).render(frameValues, html);
     
     std::string fileName = combinePath(outputBase, "index." + m_extName);
     writeFile(fileName, html);
@@ -450,6 +602,8 @@ bool Exporter::exportUser(Friend& user, std::string& userOutputPath)
         }
     }
     downloader.finishAndWaitForExit();
+    // Kept for resuming if the export is cancelled
+    journal.close(!m_cancelled);
 
     return true;
 }
@@ -479,79 +633,110 @@ bool Exporter::loadUserFriendsAndSessions(const Friend& user, Friends& friends,
     return true;
 }
 
-int Exporter::exportSession(const Friend& user, SessionParser& sessionParser, const Session& session, const std::string& userBase, const std::string& outputBase)
+int Exporter::exportSession(const Friend& user, SessionParser& sessionParser, const Session& session, const std::string& userBase, const std::string& outputBase, ExportManifest& manifest)
 {
     if (session.isDbFileEmpty())
     {
         return false;
     }
     
+    OutputTree& outputTree = sessionParser.getOutputTree();
     std::string sessionBasePath = combinePath(outputBase, session.getOutputFileName() + "_files");
-    if ((m_options & SPO_IGNORE_AVATAR) == 0)
+    outputTree.ensureDirectory(sessionBasePath);
+    // Otherwise they are in the folder of the account, which exportUser creates
+    if ((m_options & SPO_ICON_IN_SESSION) == SPO_ICON_IN_SESSION)
     {
-        std::string portraitPath = combinePath(sessionBasePath, "Portrait");
-        m_shell->makeDirectory(portraitPath);
-        std::string defaultPortrait = combinePath(portraitPath, "DefaultProfileHead@2x.png");
-        m_shell->copyFile(combinePath(m_workDir, "res", "DefaultProfileHead@2x.png"), defaultPortrait, true);
+        if ((m_options & SPO_IGNORE_AVATAR) == 0)
+        {
+            std::string portraitPath = combinePath(sessionBasePath, "Portrait");
+            outputTree.ensureDirectory(portraitPath);
+            std::string defaultPortrait = combinePath(portraitPath, "DefaultProfileHead@2x.png");
+            sessionParser.getFileCopier().copyFile(combinePath(m_workDir, "res", "DefaultProfileHead@2x.png"), defaultPortrait, 0);
+        }
+        if ((m_options & SPO_IGNORE_EMOJI) == 0)
+        {
+            outputTree.ensureDirectory(combinePath(sessionBasePath, "Emoji"));
+        }
     }
-    if ((m_options & SPO_IGNORE_EMOJI) == 0)
+
+    const size_t pageSize = 1000;
+    std::string fileName = combinePath(outputBase, session.getOutputFileName() + "." + m_extName);
+    TemplateValues frameValues("frame");
+    frameValues[TK_DISPLAYNAME] = session.getDisplayName();
+    // No page for text mode
+    bool paged = (m_options & SPO_TEXT_MODE) != SPO_TEXT_MODE && (m_options & SPO_PAGED_OUTPUT) == SPO_PAGED_OUTPUT;
+    SessionPageWriter writer(fileName, getTemplate(frameValues.getName()), frameValues, ((m_options & SPO_TEXT_MODE) == SPO_TEXT_MODE) ? SessionPageWriter::NO_PAGING : pageSize);
+    if (paged)
     {
-        m_shell->makeDirectory(combinePath(sessionBasePath, "Emoji"));
+        writer.setPaging(combinePath(outputBase, session.getOutputFileName()), ((m_options & SPO_IGNORE_HTML_ENC) == 0) ? encodeUrl(session.getOutputFileName()) : session.getOutputFileName());
     }
-
-    std::vector<std::string> messages;
-        if (session.getRecordCount() > 0)
-        {
-            messages.reserve(session.getRecordCount());
-        }
-    std::function<bool(const std::vector<TemplateValues>&)> handler = std::bind(&Exporter::exportMessage, this, std::cref(session), std::placeholders::_1, std::ref(messages));
     
-    int count = sessionParser.parse(userBase, outputBase, session, handler);
-    if (count > 0 && !messages.empty())
+    // New messages are appended to the shards of the previous export, which requires the same pages in ascending order
+    // and the same filter, or the messages which the previous export left out would never be written
+    SessionWatermark since;
+    ExportedSession exported;
+    std::string filter = ExportManifest::formatFilter(m_messageFilter);
+    if (paged && (m_options & SPO_INCREMENTAL) == SPO_INCREMENTAL && (m_options & SPO_DESC) == 0 &&
+        manifest.getSession(session.getUsrName(), exported) && exported.outputFileName == session.getOutputFileName() && exported.extName == m_extName &&
+        !exported.desc && exported.filter == filter && m_shell->existsFile(fileName) && writer.resume(exported.layout))
     {
-        const size_t pageSize = 1000;
-        
-        auto b = messages.cbegin();
-        // No page for text mode
-        auto e = (((m_options & SPO_TEXT_MODE) == SPO_TEXT_MODE) || messages.size() <= pageSize) ? messages.cend() : (b + pageSize);
-        std::string moreMsgs = ((m_options & SPO_TEXT_MODE) == SPO_TEXT_MODE) ? "" : "[]"; // [] = empty json array
-        if (e != messages.cend())
+        since.msgId = exported.lastMsgId;
+        since.createTime = exported.lastCreateTime;
+    }
+    
+    SessionRowSink sink;
+    sink.render = std::bind(&Exporter::renderMessage, this, std::placeholders::_1, std::placeholders::_2);
+    sink.write = std::bind(&Exporter::writeMessage, this, std::ref(writer), std::placeholders::_1);
+    
+    SessionWatermark last;
+    int count = sessionParser.parse(userBase, outputBase, session, since, last, sink);
+    if (!writer.close())
+    {
+        m_logger->write(formatString(getLocaleString("Failed to write file: %s"), fileName.c_str()));
+    }
+    else if (count < 0)
+    {
+        // The messages after the failure are missing: resumed pages are truncated to the layout in the manifest
+        // on the next run, and a page which is written from scratch can't be appended to
+        if (!writer.isResumed())
         {
-            Json::Value jsonMsgs(Json::arrayValue);
-            for (auto it = e; it != messages.cend(); ++it)
-            {
-                jsonMsgs.append(*it);
-            }
-            
-            Json::FastWriter writer;
-            moreMsgs = writer.write(jsonMsgs);
+            manifest.removeSession(session.getUsrName());
         }
-        
-        std::string fileName = combinePath(outputBase, session.getOutputFileName() + "." + m_extName);
-
-        std::string html = getTemplate("frame");
-        html = replaceAll(html, "%%DISPLAYNAME%%", session.getDisplayName());
-        // html = replaceAll(html, "%%PAGES%%", std::to_string(pages));
-        html = replaceAll(html, "%%BODY%%", join(b, e, ""));
-        html = replaceAll(html, "%%JSONDATA%%", moreMsgs);
-        
-        writeFile(fileName, html);
-        
-        
+        return -1;
+    }
+    else if (paged && writer.getNumberOfMessages() > 0 && (count > 0 || !writer.isResumed()))
+    {
+        exported.outputFileName = session.getOutputFileName();
+        exported.extName = m_extName;
+        exported.lastMsgId = last.msgId;
+        exported.lastCreateTime = last.createTime;
+        exported.desc = (m_options & SPO_DESC) == SPO_DESC;
+        exported.filter = filter;
+        writer.getLayout(exported.layout);
+        manifest.setSession(session.getUsrName(), exported);
     }
     
+    if (writer.isResumed())
+    {
+        m_logger->debug("Appended " + std::to_string(count) + " messages to " + session.getOutputFileName());
+        // The session is listed with the messages of the previous export
+        return static_cast<int>(writer.getNumberOfMessages());
+    }
     return count;
 }
 
-bool Exporter::exportMessage(const Session& session, const std::vector<TemplateValues>& tvs, std::vector<std::string>& messages)
+void Exporter::renderMessage(const TemplateValuesList& tvs, std::string& content) const
 {
-    std::string content;
-    for (std::vector<TemplateValues>::const_iterator it = tvs.cbegin(); it != tvs.cend(); ++it)
+    for (TemplateValuesList::const_iterator it = tvs.cbegin(); it != tvs.cend(); ++it)
     {
-        content.append(buildContentFromTemplateValues(*it));
+        buildContentFromTemplateValues(*it, content);
     }
+}
+
+bool Exporter::writeMessage(SessionPageWriter& writer, const std::string& content)
+{
+    writer.write(content);
     
-    messages.push_back(content);
     return m_cancelled;
 }
 
@@ -635,7 +820,7 @@ bool Exporter::loadTemplates()
     {
         std::string name = names[idx];
         std::string path = combinePath(m_workDir, "res", m_templatesName, name + ".html");
-        m_templates[name] = readFile(path);
+        m_templates[name].compile(readFile(path));
     }
     return true;
 }
@@ -666,10 +851,11 @@ bool Exporter::loadStrings()
     return true;
 }
 
-std::string Exporter::getTemplate(const std::string& key) const
+const Template& Exporter::getTemplate(const std::string& key) const
 {
-    std::map<std::string, std::string>::const_iterator it = m_templates.find(key);
-    return (it == m_templates.cend()) ? "" : it->second;
+    static const Template emptyTemplate;
+    std::map<std::string, Template>::const_iterator it = m_templates.find(key);
+    return (it == m_templates.cend()) ? emptyTemplate : it->second;
 }
 
 std::string Exporter::getLocaleString(const std::string& key) const
@@ -679,30 +865,9 @@ std::string Exporter::getLocaleString(const std::string& key) const
     return it == m_localeStrings.cend() ? key : it->second;
 }
 
-std::string Exporter::buildContentFromTemplateValues(const TemplateValues& values) const
+void Exporter::buildContentFromTemplateValues(const TemplateValues& values, std::string& content) const
 {
-    std::string content = getTemplate(values.getName());
-    for (TemplateValues::const_iterator it = values.cbegin(); it != values.cend(); ++it)
-    {
-        if (startsWith(it->first, "%"))
-        {
-            content = replaceAll(content, it->first, it->second);
-        }
-    }
-    
-    std::string::size_type pos = 0;
-    while ((pos = content.find("%%", pos)) != std::string::npos)
-    {
-        std::string::size_type posEnd = content.find("%%", pos + 2);
-        if (posEnd == std::string::npos)
-        {
-            break;
-        }
-        
-        content.erase(pos, posEnd + 2 - pos);
-    }
-    
-    return content;
+    getTemplate(values.getName()).render(values, content);
 }
 
 
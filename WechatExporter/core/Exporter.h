@@ -20,12 +20,14 @@
 #include "ITunesParser.h"
 #include "semaphore.h"
 #include "ExportNotifier.h"
+#include "TemplateValues.h"
 
 #ifndef Exporter_h
 #define Exporter_h
 
 class SessionParser;
-class TemplateValues;
+class SessionPageWriter;
+class ExportManifest;
 
 class Exporter
 {
@@ -45,7 +47,7 @@ protected:
     ITunesDb *m_iTunesDb;
     ITunesDb *m_iTunesDbShare;
     
-    std::map<std::string, std::string> m_templates;
+    std::map<std::string, Template> m_templates;
     std::map<std::string, std::string> m_localeStrings;
 
     ExportNotifier* m_notifier;
@@ -56,6 +58,7 @@ protected:
     std::string m_templatesName;
     
     std::map<std::string, std::set<std::string>> m_usersAndSessions;
+    MessageFilter m_messageFilter;
     
 public:
     Exporter(const std::string& workDir, const std::string& backup, const std::string& output, Shell* shell, Logger* logger);
@@ -71,9 +74,25 @@ public:
     void waitForComplition();
     
     void filterUsersAndSessions(const std::map<std::string, std::set<std::string>>& usersAndSessions);
+    // Time window, message types and senders of the messages to export, a session without matching messages is left out
+    void filterMessages(const MessageFilter& filter);
     void setTextMode(bool textMode = true);
     void setOrder(bool asc = true);
     void saveFilesInSessionFolder(bool flags = true);
+    void setPagedOutput(bool paged = true);
+    // Hard links (or relative symbolic links) to the files of the backup on the same file system, no copies
+    void linkFilesToBackup(bool flag = true);
+    // Every distinct media file is written once into Assets/ of the account, the files of sessions are links to it
+    void shareAssets(bool flag = true);
+    // Media files with the same size and modified time as the backup are kept when exporting to the same folder again, unless it is set
+    void setOverwritingFiles(bool flag = true);
+    // Only the messages after the previous export are appended to its pages, which turns on paged output and ascending order
+    void setIncrementalExport(bool incremental = true);
+    // The export keeps a journal, so it can be resumed if it's killed or cancelled: the sessions which the interrupted export
+    // with the same options completed are skipped, and its pending downloads are queued again. Without it there is no journal
+    void setResuming(bool resuming = true);
+    // Pragmas of the databases of the backup (mmap, page cache, temp store), which apply to the whole process
+    void setDatabaseProfile(const SqliteReadProfile& profile);
     void setExtName(const std::string& extName);
     void setTemplatesName(const std::string& templatesName);
 
@@ -82,23 +101,26 @@ protected:
     bool exportUser(Friend& user, std::string& userOutputPath);
     // bool loadUserSessions(Friend& user, std::vector<Session>& sessions) const;
     bool loadUserFriendsAndSessions(const Friend& user, Friends& friends, std::vector<Session>& sessions, bool detailedInfo = true) const;
-    int exportSession(const Friend& user, SessionParser& sessionParser, const Session& session, const std::string& userBase, const std::string& outputBase);
+    // -1 if the messages can't be read completely, the session is exported again by the next run then
+    int exportSession(const Friend& user, SessionParser& sessionParser, const Session& session, const std::string& userBase, const std::string& outputBase, ExportManifest& manifest);
     
-    bool exportMessage(const Session& session, const std::vector<TemplateValues>& tvs, std::vector<std::string>& messages);
+    // Called on the threads which parse the rows, only reads the templates
+    void renderMessage(const TemplateValuesList& tvs, std::string& content) const;
+    bool writeMessage(SessionPageWriter& writer, const std::string& content);
 
     bool fillSession(Session& session, const Friends& friends) const;
     void releaseITunes();
     bool loadITunes(bool detailedInfo = true);
     bool loadTemplates();
     bool loadStrings();
-    std::string getTemplate(const std::string& key) const;
+    const Template& getTemplate(const std::string& key) const;
     std::string getLocaleString(const std::string& key) const;
     
     void notifyStart();
     void notifyComplete(bool cancelled = false);
     void notifyProgress(uint32_t numberOfMessages, uint32_t numberOfTotalMessages);
     bool buildFileNameForUser(Friend& user, std::set<std::string>& existingFileNames);
-    std::string buildContentFromTemplateValues(const TemplateValues& values) const;
+    void buildContentFromTemplateValues(const TemplateValues& values, std::string& content) const;
     
     bool filterITunesFile(const char * file, int flags) const;
 };
@@ -0,0 +1,522 @@
+//
+//  FileCopier.cpp
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+
+#include "FileCopier.h"
+#include <chrono>
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+#ifdef _WIN32
+#include <windows.h>
+#include <atlstr.h>
+#include "Utils.h"
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <stdlib.h>
+#endif
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#endif
+#ifdef __APPLE__
+#include <sys/attr.h>
+#include <sys/clonefile.h>
+#endif
+
+// Buffer of the read/write loop, large enough for the disk to stream
+#define FILE_COPIER_BUFFER_SIZE     (1024 * 1024)
+// Largest chunk for copy_file_range and sendfile in one call
+#define FILE_COPIER_CHUNK_SIZE      (1024 * 1024 * 1024)
+
+#ifndef _WIN32
+
+enum CopyResult
+{
+    CR_OK = 0,
+    CR_UNSUPPORTED,     // Nothing is written, the next strategy may work
+    CR_FAILED
+};
+
+static bool isUnsupportedError(int err)
+{
+    return err == ENOSYS || err == EXDEV || err == EINVAL || err == EOPNOTSUPP || err == ENOTSUP || err == EPERM || err == EBADF || err == ETXTBSY;
+}
+
+#ifdef __linux__
+static CopyResult copyWithCopyFileRange(int srcFd, int destFd, uint64_t size)
+{
+#ifdef __NR_copy_file_range
+    loff_t srcOffset = 0;
+    loff_t destOffset = 0;
+    while (static_cast<uint64_t>(srcOffset) < size)
+    {
+        size_t length = static_cast<size_t>(std::min<uint64_t>(size - srcOffset, FILE_COPIER_CHUNK_SIZE));
+        // Call it through syscall so it doesn't depend on the version of glibc
+        ssize_t copied = syscall(__NR_copy_file_range, srcFd, &srcOffset, destFd, &destOffset, length, 0);
+        if (copied < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return (srcOffset == 0 && isUnsupportedError(errno)) ? CR_UNSUPPORTED : CR_FAILED;
+        }
+        if (copied == 0)
+        {
+            // The source is shorter than it was
+            break;
+        }
+    }
+    return CR_OK;
+#else
+    return CR_UNSUPPORTED;
+#endif
+}
+
+static CopyResult copyWithSendfile(int srcFd, int destFd, uint64_t size)
+{
+    off_t srcOffset = 0;
+    if (lseek(destFd, 0, SEEK_SET) != 0)
+    {
+        return CR_FAILED;
+    }
+    while (static_cast<uint64_t>(srcOffset) < size)
+    {
+        size_t length = static_cast<size_t>(std::min<uint64_t>(size - srcOffset, FILE_COPIER_CHUNK_SIZE));
+        ssize_t copied = sendfile(destFd, srcFd, &srcOffset, length);
+        if (copied < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return (srcOffset == 0 && isUnsupportedError(errno)) ? CR_UNSUPPORTED : CR_FAILED;
+        }
+        if (copied == 0)
+        {
+            break;
+        }
+    }
+    return CR_OK;
+}
+#endif // __linux__
+
+static CopyResult copyWithReadWrite(int srcFd, int destFd)
+{
+    static thread_local std::vector<char> buffer;
+    if (buffer.empty())
+    {
+        buffer.resize(FILE_COPIER_BUFFER_SIZE);
+    }
+
+    off_t offset = 0;
+    while (true)
+    {
+        ssize_t bytesRead = pread(srcFd, &buffer[0], buffer.size(), offset);
+        if (bytesRead < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return CR_FAILED;
+        }
+        if (bytesRead == 0)
+        {
+            break;
+        }
+        ssize_t bytesWritten = 0;
+        while (bytesWritten < bytesRead)
+        {
+            ssize_t written = pwrite(destFd, &buffer[bytesWritten], bytesRead - bytesWritten, offset + bytesWritten);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return CR_FAILED;
+            }
+            bytesWritten += written;
+        }
+        offset += bytesRead;
+    }
+    return CR_OK;
+}
+
+static void splitPath(const std::string& path, std::vector<std::string>& components)
+{
+    std::string::size_type start = 0;
+    while (start < path.size())
+    {
+        std::string::size_type end = path.find('/', start);
+        if (end == std::string::npos)
+        {
+            end = path.size();
+        }
+        if (end > start)
+        {
+            components.push_back(path.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+}
+
+// Path of src relative to the folder of dest, so the link still works after the output and the backup are moved together
+static bool buildRelativePath(const std::string& src, const std::string& dest, std::string& relativePath)
+{
+    std::string::size_type pos = dest.find_last_of('/');
+    std::string destDir = (pos == std::string::npos) ? "." : ((pos == 0) ? "/" : dest.substr(0, pos));
+
+    char buffer[PATH_MAX];
+    if (realpath(src.c_str(), buffer) == NULL)
+    {
+        return false;
+    }
+    std::vector<std::string> srcComponents;
+    splitPath(buffer, srcComponents);
+    if (realpath(destDir.c_str(), buffer) == NULL)
+    {
+        return false;
+    }
+    std::vector<std::string> destComponents;
+    splitPath(buffer, destComponents);
+
+    size_t common = 0;
+    while (common < srcComponents.size() && common < destComponents.size() && srcComponents[common] == destComponents[common])
+    {
+        common++;
+    }
+    relativePath.clear();
+    for (size_t idx = common; idx < destComponents.size(); ++idx)
+    {
+        relativePath.append("../");
+    }
+    for (size_t idx = common; idx < srcComponents.size(); ++idx)
+    {
+        if (idx > common)
+        {
+            relativePath.push_back('/');
+        }
+        relativePath.append(srcComponents[idx]);
+    }
+    return !relativePath.empty();
+}
+
+#endif // !_WIN32
+
+#ifndef _WIN32
+static inline int getDirFd(const OutputTree::DirectoryPtr& directory)
+{
+    return directory ? directory->getFd() : AT_FDCWD;
+}
+#endif
+
+FileCopier::FileCopier() : m_linkingFiles(false), m_skippingUnchanged(false), m_outputTree(NULL)
+{
+}
+
+void FileCopier::resolveTarget(Target& target) const
+{
+#ifndef _WIN32
+    if (NULL != m_outputTree)
+    {
+        target.directory = m_outputTree->openParentDirectory(target.path, target.name);
+        if (target.directory)
+        {
+            return;
+        }
+    }
+#else
+    if (NULL != m_outputTree)
+    {
+        std::string fileName;
+        m_outputTree->openParentDirectory(target.path, fileName);
+    }
+#endif
+    target.directory.reset();
+    target.name = target.path;
+}
+
+bool FileCopier::isUnchanged(const std::string& src, const Target& target, time_t mtime, bool linking, uint64_t& size) const
+{
+#ifdef _WIN32
+    // No cheap way to tell hard links, so only the size and the time are compared
+    uint64_t destSize = 0;
+    time_t srcTime = 0;
+    time_t destTime = 0;
+    if (!getFileSizeAndTime(src, size, srcTime) || !getFileSizeAndTime(target.path, destSize, destTime))
+    {
+        return false;
+    }
+    return mtime != 0 && destSize == size && destTime == mtime;
+#else
+    struct stat srcSt;
+    struct stat destSt;
+    if (stat(src.c_str(), &srcSt) != 0 || fstatat(getDirFd(target.directory), target.name.c_str(), &destSt, AT_SYMLINK_NOFOLLOW) != 0)
+    {
+        return false;
+    }
+    size = static_cast<uint64_t>(srcSt.st_size);
+    if (srcSt.st_dev == destSt.st_dev && srcSt.st_ino == destSt.st_ino)
+    {
+        // A link left by an export in link mode is replaced with a copy if it isn't linking now
+        return linking;
+    }
+    if (linking && srcSt.st_dev == destSt.st_dev)
+    {
+        // A copy on the same file system, which can be a link now
+        return false;
+    }
+    return S_ISREG(destSt.st_mode) && mtime != 0 && destSt.st_size == srcSt.st_size && destSt.st_mtime == mtime;
+#endif
+}
+
+bool FileCopier::createLink(const std::string& src, const Target& target, FileCopyStrategy& strategy, uint64_t& size) const
+{
+#ifdef _WIN32
+    CW2T pszSrc(CA2W(src.c_str(), CP_UTF8));
+    CW2T pszDest(CA2W(target.path.c_str(), CP_UTF8));
+
+    WIN32_FILE_ATTRIBUTE_DATA attrs;
+    if (!GetFileAttributesEx(pszSrc, GetFileExInfoStandard, &attrs))
+    {
+        return false;
+    }
+    size = (static_cast<uint64_t>(attrs.nFileSizeHigh) << 32) | attrs.nFileSizeLow;
+    ::DeleteFile(pszDest);
+    // Symbolic links require the privilege on Windows, so it is copied if the hard link fails
+    if (::CreateHardLink(pszDest, pszSrc, NULL))
+    {
+        strategy = FCS_HARDLINK;
+        return true;
+    }
+    return false;
+#else
+    struct stat st;
+    if (stat(src.c_str(), &st) != 0)
+    {
+        return false;
+    }
+    size = static_cast<uint64_t>(st.st_size);
+    int dirFd = getDirFd(target.directory);
+    unlinkat(dirFd, target.name.c_str(), 0);
+    if (linkat(AT_FDCWD, src.c_str(), dirFd, target.name.c_str(), 0) == 0)
+    {
+        strategy = FCS_HARDLINK;
+        return true;
+    }
+    if (errno == EXDEV)
+    {
+        // A symbolic link would depend on a file on another disk, copy it instead
+        return false;
+    }
+    std::string relativePath;
+    if (buildRelativePath(src, target.path, relativePath) && symlinkat(relativePath.c_str(), dirFd, target.name.c_str()) == 0)
+    {
+        strategy = FCS_SYMLINK;
+        return true;
+    }
+    return false;
+#endif
+}
+
+bool FileCopier::copyFile(const std::string& src, const std::string& dest, time_t mtime) const
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    FileCopyStrategy strategy = FCS_MAX;
+    uint64_t size = 0;
+    Target target(dest);
+    resolveTarget(target);
+
+    if (m_skippingUnchanged && isUnchanged(src, target, mtime, m_linkingFiles, size))
+    {
+        strategy = FCS_UNCHANGED;
+    }
+    else if (m_linkingFiles)
+    {
+        // The strategy is left as it is if it can't be linked
+        createLink(src, target, strategy, size);
+    }
+    if (strategy != FCS_MAX)
+    {
+        addStatistics(strategy, size, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+        return true;
+    }
+
+#ifdef _WIN32
+    CW2T pszSrc(CA2W(src.c_str(), CP_UTF8));
+    CW2T pszDest(CA2W(dest.c_str(), CP_UTF8));
+
+    // The destination may be a link to the backup from a previous export, don't write through it
+    ::DeleteFile(pszDest);
+    if (::CopyFile(pszSrc, pszDest, FALSE) != TRUE)
+    {
+        return false;
+    }
+    if (mtime != 0)
+    {
+        updateFileTime(dest, mtime);
+    }
+    WIN32_FILE_ATTRIBUTE_DATA attrs;
+    if (GetFileAttributesEx(pszDest, GetFileExInfoStandard, &attrs))
+    {
+        size = (static_cast<uint64_t>(attrs.nFileSizeHigh) << 32) | attrs.nFileSizeLow;
+    }
+    strategy = FCS_SYSTEM;
+#else
+    int srcFd = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (srcFd == -1)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(srcFd, &st) != 0)
+    {
+        close(srcFd);
+        return false;
+    }
+    size = static_cast<uint64_t>(st.st_size);
+
+    struct timespec times[2];
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_OMIT;  // Keep atime
+    times[1].tv_sec = mtime;
+    times[1].tv_nsec = 0;
+
+    // The destination may be a link to the backup from a previous export, don't write through it
+    // and clonefile requires the destination not to exist
+    int destDirFd = getDirFd(target.directory);
+    unlinkat(destDirFd, target.name.c_str(), 0);
+#ifdef __APPLE__
+    if (clonefileat(AT_FDCWD, src.c_str(), destDirFd, target.name.c_str(), 0) == 0)
+    {
+        close(srcFd);
+        if (mtime != 0)
+        {
+            utimensat(destDirFd, target.name.c_str(), times, 0);
+        }
+        addStatistics(FCS_CLONE, size, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+        return true;
+    }
+#endif
+
+    int destFd = openat(destDirFd, target.name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (destFd == -1)
+    {
+        close(srcFd);
+        return false;
+    }
+
+    CopyResult result = CR_UNSUPPORTED;
+#ifdef __linux__
+    if (ioctl(destFd, FICLONE, srcFd) == 0)
+    {
+        result = CR_OK;
+        strategy = FCS_CLONE;
+    }
+    if (result == CR_UNSUPPORTED)
+    {
+        result = copyWithCopyFileRange(srcFd, destFd, size);
+        strategy = FCS_COPY_FILE_RANGE;
+    }
+    if (result == CR_UNSUPPORTED)
+    {
+        result = copyWithSendfile(srcFd, destFd, size);
+        strategy = FCS_SENDFILE;
+    }
+#endif
+    if (result == CR_UNSUPPORTED)
+    {
+        result = copyWithReadWrite(srcFd, destFd);
+        strategy = FCS_READ_WRITE;
+    }
+
+    if (result == CR_OK && mtime != 0)
+    {
+        futimens(destFd, times);
+    }
+    close(srcFd);
+    if (close(destFd) != 0 || result != CR_OK)
+    {
+        return false;
+    }
+#endif
+
+    addStatistics(strategy, size, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    return true;
+}
+
+bool FileCopier::linkFile(const std::string& src, const std::string& dest) const
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    FileCopyStrategy strategy = FCS_MAX;
+    uint64_t size = 0;
+    Target target(dest);
+    resolveTarget(target);
+    if (m_skippingUnchanged && isUnchanged(src, target, 0, true, size))
+    {
+        strategy = FCS_UNCHANGED;
+    }
+    else if (!createLink(src, target, strategy, size))
+    {
+        return false;
+    }
+    addStatistics(strategy, size, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    return true;
+}
+
+void FileCopier::addStatistics(FileCopyStrategy strategy, uint64_t bytes, uint64_t microseconds) const
+{
+    if (strategy < 0 || strategy >= FCS_MAX)
+    {
+        return;
+    }
+    m_statistics[strategy].files++;
+    m_statistics[strategy].bytes += bytes;
+    m_statistics[strategy].microseconds += microseconds;
+}
+
+const char* FileCopier::getStrategyName(FileCopyStrategy strategy)
+{
+    static const char* names[FCS_MAX] = { "clone", "copy_file_range", "sendfile", "read/write", "system", "hard link", "symbolic link", "unchanged" };
+    return (strategy >= 0 && strategy < FCS_MAX) ? names[strategy] : "";
+}
+
+std::string FileCopier::getStatistics() const
+{
+    std::string result;
+    for (int idx = 0; idx < FCS_MAX; ++idx)
+    {
+        uint64_t files = m_statistics[idx].files;
+        if (files == 0)
+        {
+            continue;
+        }
+        uint64_t bytes = m_statistics[idx].bytes;
+        uint64_t microseconds = m_statistics[idx].microseconds;
+        double mb = static_cast<double>(bytes) / (1024 * 1024);
+        double speed = microseconds == 0 ? 0.0 : mb * 1000000 / microseconds;
+
+        char buffer[160] = { 0 };
+        snprintf(buffer, sizeof(buffer), "%s: %llu files, %.1f MB, %.1f MB/s", getStrategyName(static_cast<FileCopyStrategy>(idx)), static_cast<unsigned long long>(files), mb, speed);
+        if (!result.empty())
+        {
+            result += "; ";
+        }
+        result += buffer;
+    }
+    return result;
+}
@@ -0,0 +1,114 @@
+//
+//  FileCopier.h
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+
+#ifndef FileCopier_h
+#define FileCopier_h
+
+#include <string>
+#include <atomic>
+#include <ctime>
+#include <cstdint>
+#include "OutputTree.h"
+
+enum FileCopyStrategy
+{
+    FCS_CLONE = 0,          // FICLONE on Linux, clonefile on macOS: the blocks are shared, no data is copied
+    FCS_COPY_FILE_RANGE,    // Copied in the kernel, may be offloaded to the file system or device
+    FCS_SENDFILE,           // Copied in the kernel
+    FCS_READ_WRITE,         // Copied through a buffer in user space
+    FCS_SYSTEM,             // CopyFile on Windows
+    FCS_HARDLINK,           // Linked to the source, nothing is copied
+    FCS_SYMLINK,            // Relative symbolic link to the source, when the file system doesn't support hard links
+    FCS_UNCHANGED,          // Written by the previous export, same size and modified time (or the same file if linked)
+
+    FCS_MAX
+};
+
+// Copies media files from the backup to the output with the cheapest way the platform and file systems support,
+// falling back strategy by strategy, and sets the modified time on the open file
+// Thread-safe, the statistics are kept per strategy
+//
+// In link mode, the destination is linked to the source instead: a hard link first, a relative symbolic link
+// if the file system doesn't support hard links and a copy if they are on different file systems
+// The modified time of a linked file is left alone as it is the source file
+class FileCopier
+{
+protected:
+    struct Statistics
+    {
+        std::atomic<uint64_t> files;
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> microseconds;
+
+        Statistics() : files(0), bytes(0), microseconds(0)
+        {
+        }
+    };
+
+    // Destination resolved against its open folder in the output tree, if there is one
+    struct Target
+    {
+        const std::string& path;
+        OutputTree::DirectoryPtr directory;
+        std::string name;       // Relative to the directory, or the path if there is no directory
+
+        explicit Target(const std::string& dest) : path(dest)
+        {
+        }
+    };
+
+    mutable Statistics m_statistics[FCS_MAX];
+    bool m_linkingFiles;
+    bool m_skippingUnchanged;
+    OutputTree* m_outputTree;
+
+public:
+    FileCopier();
+
+    void setLinkingFiles(bool linkingFiles)
+    {
+        m_linkingFiles = linkingFiles;
+    }
+    bool isLinkingFiles() const
+    {
+        return m_linkingFiles;
+    }
+    // Keep the destination which has the size and the modified time of the source, e.g.: exporting to the same folder again
+    // Files copied with mtime 0 are always written
+    void setSkippingUnchanged(bool skippingUnchanged)
+    {
+        m_skippingUnchanged = skippingUnchanged;
+    }
+    bool isSkippingUnchanged() const
+    {
+        return m_skippingUnchanged;
+    }
+    // The folders of destinations are created and kept open by the tree
+    void setOutputTree(OutputTree* outputTree)
+    {
+        m_outputTree = outputTree;
+    }
+
+    // mtime: 0 to keep the time of copying
+    bool copyFile(const std::string& src, const std::string& dest, time_t mtime) const;
+    // Hard link or relative symbolic link whatever the mode is, false if the file system supports neither
+    bool linkFile(const std::string& src, const std::string& dest) const;
+
+    // e.g.: "copy_file_range: 120 files, 1024.0 MB, 850.3 MB/s; read/write: ..."
+    std::string getStatistics() const;
+
+    static const char* getStrategyName(FileCopyStrategy strategy);
+
+protected:
+    void resolveTarget(Target& target) const;
+    bool isUnchanged(const std::string& src, const Target& target, time_t mtime, bool linking, uint64_t& size) const;
+    bool createLink(const std::string& src, const Target& target, FileCopyStrategy& strategy, uint64_t& size) const;
+    void addStatistics(FileCopyStrategy strategy, uint64_t bytes, uint64_t microseconds) const;
+};
+
+#endif /* FileCopier_h */
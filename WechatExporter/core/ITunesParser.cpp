@@ -129,8 +129,9 @@ inline std::string PlistDictionary::toString(const xmlChar* ch, int len)
     return std::string(p, p + len);
 }
 
-ITunesDb::ITunesDb(const std::string& rootPath, const std::string& manifestFileName) : m_rootPath(rootPath), m_manifestFileName(manifestFileName)
+ITunesDb::ITunesDb(const std::string& rootPath, const std::string& manifestFileName) : m_rootPath(rootPath), m_manifestFileName(manifestFileName), m_vfs(NULL)
 {
+    m_vfs = new BackupVfs(this);
     std::replace(m_rootPath.begin(), m_rootPath.end(), DIR_SEP_R, DIR_SEP);
     
     if (!endsWith(m_rootPath, DIR_SEP))
@@ -146,6 +147,8 @@ ITunesDb::~ITunesDb()
         delete *it;
     }
     m_files.clear();
+    delete m_vfs;
+    m_vfs = NULL;
 }
 
 bool ITunesDb::load()
@@ -171,7 +174,7 @@ bool ITunesDb::load(const std::string& domain, bool onlyFile)
     std::string dbPath = combinePath(m_rootPath, m_manifestFileName);
     
     sqlite3 *db = NULL;
-    int rc = openSqlite3ReadOnly(dbPath, &db);
+    int rc = openSqlite3ReadOnly(dbPath, &db, m_vfs->getName());
     if (rc != SQLITE_OK)
     {
         // printf("Open database failed!");
@@ -183,7 +186,6 @@ bool ITunesDb::load(const std::string& domain, bool onlyFile)
     printf("PERF: start.....%s\r\n", getCurrentTimestamp(false, true).c_str());
 #endif
 
-    sqlite3_exec(db, "PRAGMA mmap_size=2097152;", NULL, NULL, NULL); // 8M:8388608  2M 2097152
     sqlite3_exec(db, "PRAGMA synchronous=OFF;", NULL, NULL, NULL);
     
     std::string sql = "SELECT fileID,relativePath,flags,file FROM Files";
@@ -342,6 +344,16 @@ std::string ITunesDb::findRealPath(const std::string& relativePath) const
     return fileIdToRealPath(fieldId);
 }
 
+int ITunesDb::openDatabase(const std::string& path, sqlite3 **ppDb) const
+{
+    if (NULL == m_vfs->getName())
+    {
+        std::string realPath = findRealPath(path);
+        return openSqlite3ReadOnly(realPath.empty() ? path : realPath, ppDb);
+    }
+    return openSqlite3ReadOnly(path, ppDb, m_vfs->getName());
+}
+
 ManifestParser::ManifestParser(const std::string& manifestPath, const Shell* shell) : m_manifestPath(manifestPath), m_shell(shell)
 {
 }
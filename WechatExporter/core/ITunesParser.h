@@ -15,6 +15,7 @@
 #include <ctime>
 #include "Shell.h"
 #include "Utils.h"
+#include "BackupVfs.h"
 
 #ifndef ITunesParser_h
 #define ITunesParser_h
@@ -185,6 +186,14 @@ public:
     
     std::string getRealPath(const ITunesFile& file) const;
     
+    // The VFS which opens the relativePaths (and the real paths) of the backup, NULL if it isn't registered
+    const char* getVfsName() const
+    {
+        return m_vfs->getName();
+    }
+    // path: relativePath of the file or its real path
+    int openDatabase(const std::string& path, sqlite3 **ppDb) const;
+    
     static unsigned int parseModifiedTime(const std::vector<unsigned char>& data);
     
 protected:
@@ -194,6 +203,7 @@ protected:
     std::string m_version;
     std::string m_iOSVersion;
     std::function<bool(const char *, int flags)> m_loadingFilter;
+    BackupVfs* m_vfs;
 };
 
 template<class TFilter>
@@ -0,0 +1,346 @@
+//
+//  MessageReader.cpp
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+
+#include "MessageReader.h"
+#include <algorithm>
+#include <cstdio>
+#include <sqlite3.h>
+#include "WechatParser.h"
+#include "SqliteConnectionPool.h"
+
+// Keys read from a spilled run at a time
+#define MESSAGE_READER_RUN_BUFFER_SIZE  4096
+
+static const char* getPathName(MessageReadingPath path)
+{
+    switch (path)
+    {
+        case MRP_ROWID:
+            return "rowid order";
+        case MRP_SORTED:
+            return "sorted";
+        case MRP_RANGES:
+            return "rowid ranges";
+        default:
+            return "unknown";
+    }
+}
+
+MessageReader::Statistics::Statistics() : m_spilledRuns(0)
+{
+    for (int idx = 0; idx < MRP_MAX; ++idx)
+    {
+        m_sessions[idx] = 0;
+        m_rows[idx] = 0;
+    }
+}
+
+void MessageReader::Statistics::add(MessageReadingPath path, uint64_t rows, uint64_t spilledRuns)
+{
+    if (path < MRP_MAX)
+    {
+        m_sessions[path]++;
+        m_rows[path] += rows;
+        m_spilledRuns += spilledRuns;
+    }
+}
+
+std::string MessageReader::Statistics::toString() const
+{
+    std::string result;
+    for (int idx = 0; idx < MRP_MAX; ++idx)
+    {
+        uint64_t sessions = m_sessions[idx];
+        if (sessions == 0)
+        {
+            continue;
+        }
+
+        char buffer[160] = { 0 };
+        snprintf(buffer, sizeof(buffer), "%s: %llu chats, %llu rows", getPathName(static_cast<MessageReadingPath>(idx)), static_cast<unsigned long long>(sessions), static_cast<unsigned long long>(m_rows[idx]));
+        if (!result.empty())
+        {
+            result += "; ";
+        }
+        result += buffer;
+        if (idx == MRP_SORTED)
+        {
+            result += ", " + std::to_string(static_cast<unsigned long long>(m_spilledRuns)) + " spilled runs";
+        }
+    }
+    return result;
+}
+
+MessageReader::MessageReader(SqliteConnection& connection, const std::string& table, bool descending) : m_connection(connection), m_table(table), m_descending(descending), m_path(MRP_MAX), m_stmt(NULL), m_numberOfRows(0), m_numberOfSpilledRuns(0), m_maxKeysInMemory(DEFAULT_MAX_KEYS_IN_MEMORY), m_checkingOrder(true), m_statistics(NULL)
+{
+}
+
+MessageReader::~MessageReader()
+{
+    close();
+}
+
+bool MessageReader::open(const std::string& conditions, const ParameterBinder& binder)
+{
+    close();
+
+    std::string whereClause = conditions.empty() ? "" : (" WHERE " + conditions);
+    bool inOrder = true;
+    if (m_checkingOrder && !checkOrder(whereClause, binder, inOrder))
+    {
+        return false;
+    }
+
+    if (inOrder)
+    {
+        m_stmt = prepare("SELECT CreateTime,Message,Des,Type,MesLocalID FROM " + m_table + whereClause + (m_descending ? " ORDER BY rowid DESC" : " ORDER BY rowid"), binder);
+    }
+    else
+    {
+        if (!sortKeys(whereClause, binder))
+        {
+            close();
+            return false;
+        }
+        m_stmt = prepare("SELECT CreateTime,Message,Des,Type,MesLocalID FROM " + m_table + " WHERE rowid=?", ParameterBinder());
+    }
+    if (NULL == m_stmt)
+    {
+        close();
+        return false;
+    }
+
+    m_path = inOrder ? MRP_ROWID : MRP_SORTED;
+    return true;
+}
+
+bool MessageReader::next(MsgRecord& record)
+{
+    if (NULL == m_stmt)
+    {
+        return false;
+    }
+
+    if (m_path == MRP_ROWID)
+    {
+        if (sqlite3_step(m_stmt) != SQLITE_ROW)
+        {
+            return false;
+        }
+        readRecord(record);
+        m_numberOfRows++;
+        return true;
+    }
+
+    std::function<bool(size_t, size_t)> comp = std::bind(&MessageReader::isRunAfter, this, std::placeholders::_1, std::placeholders::_2);
+    while (!m_heap.empty())
+    {
+        std::pop_heap(m_heap.begin(), m_heap.end(), comp);
+        Run& run = m_runs[m_heap.back()];
+        int64_t rowid = run.keys[run.position++].rowid;
+        if (fillRun(run))
+        {
+            std::push_heap(m_heap.begin(), m_heap.end(), comp);
+        }
+        else
+        {
+            m_heap.pop_back();
+        }
+
+        sqlite3_reset(m_stmt);
+        sqlite3_bind_int64(m_stmt, 1, rowid);
+        if (sqlite3_step(m_stmt) == SQLITE_ROW)
+        {
+            readRecord(record);
+            m_numberOfRows++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void MessageReader::close()
+{
+    if (NULL != m_stmt)
+    {
+        m_connection.reset(m_stmt);
+        m_stmt = NULL;
+    }
+    for (std::vector<Run>::iterator it = m_runs.begin(); it != m_runs.end(); ++it)
+    {
+        if (NULL != it->file)
+        {
+            fclose(it->file);
+        }
+    }
+    m_runs.clear();
+    m_heap.clear();
+
+    if (m_path != MRP_MAX && NULL != m_statistics)
+    {
+        m_statistics->add(m_path, m_numberOfRows, m_numberOfSpilledRuns);
+    }
+    m_path = MRP_MAX;
+    m_numberOfRows = 0;
+    m_numberOfSpilledRuns = 0;
+}
+
+sqlite3_stmt* MessageReader::prepare(const std::string& sql, const ParameterBinder& binder) const
+{
+    sqlite3_stmt* stmt = m_connection.prepare(sql);
+    if (NULL == stmt)
+    {
+        return NULL;
+    }
+    if (binder)
+    {
+        binder(stmt);
+    }
+    return stmt;
+}
+
+bool MessageReader::checkOrder(const std::string& whereClause, const ParameterBinder& binder, bool& inOrder) const
+{
+    // Only CreateTime, which is in the front of the row, the messages in the overflow pages are not read
+    sqlite3_stmt* stmt = prepare("SELECT CreateTime FROM " + m_table + whereClause + " ORDER BY rowid", binder);
+    if (NULL == stmt)
+    {
+        return false;
+    }
+
+    inOrder = true;
+    bool first = true;
+    int lastCreateTime = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        int createTime = sqlite3_column_int(stmt, 0);
+        if (!first && createTime < lastCreateTime)
+        {
+            inOrder = false;
+            break;
+        }
+        first = false;
+        lastCreateTime = createTime;
+    }
+    m_connection.reset(stmt);
+    return true;
+}
+
+bool MessageReader::sortKeys(const std::string& whereClause, const ParameterBinder& binder)
+{
+    sqlite3_stmt* stmt = prepare("SELECT rowid,CreateTime FROM " + m_table + whereClause + " ORDER BY rowid", binder);
+    if (NULL == stmt)
+    {
+        return false;
+    }
+
+    // Every run is a range of rowids
+    std::vector<SortKey> keys;
+    SortKey key;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        key.rowid = sqlite3_column_int64(stmt, 0);
+        key.createTime = sqlite3_column_int(stmt, 1);
+        keys.push_back(key);
+        if (keys.size() >= m_maxKeysInMemory)
+        {
+            addRun(keys, true);
+        }
+    }
+    m_connection.reset(stmt);
+    // The last run stays in memory
+    addRun(keys, false);
+
+    std::function<bool(size_t, size_t)> comp = std::bind(&MessageReader::isRunAfter, this, std::placeholders::_1, std::placeholders::_2);
+    for (size_t idx = 0; idx < m_runs.size(); ++idx)
+    {
+        if (fillRun(m_runs[idx]))
+        {
+            m_heap.push_back(idx);
+        }
+    }
+    std::make_heap(m_heap.begin(), m_heap.end(), comp);
+    return true;
+}
+
+void MessageReader::addRun(std::vector<SortKey>& keys, bool spilling)
+{
+    if (keys.empty())
+    {
+        return;
+    }
+    std::sort(keys.begin(), keys.end(), [this](const SortKey& key1, const SortKey& key2) { return isBefore(key1, key2); });
+
+    m_runs.push_back(Run());
+    Run& run = m_runs.back();
+    run.file = spilling ? tmpfile() : NULL;
+    if (NULL != run.file)
+    {
+        if (fwrite(&keys[0], sizeof(SortKey), keys.size(), run.file) == keys.size() && fflush(run.file) == 0)
+        {
+            rewind(run.file);
+            m_numberOfSpilledRuns++;
+            keys.clear();
+            return;
+        }
+        fclose(run.file);
+        run.file = NULL;
+    }
+    // No temporary file, the run is kept in memory
+    run.keys.swap(keys);
+    keys.clear();
+}
+
+bool MessageReader::fillRun(Run& run)
+{
+    if (run.position < run.keys.size())
+    {
+        return true;
+    }
+    if (NULL == run.file)
+    {
+        return false;
+    }
+
+    run.keys.resize(MESSAGE_READER_RUN_BUFFER_SIZE);
+    size_t numberOfKeys = fread(&run.keys[0], sizeof(SortKey), run.keys.size(), run.file);
+    run.keys.resize(numberOfKeys);
+    run.position = 0;
+    return numberOfKeys > 0;
+}
+
+bool MessageReader::isBefore(const SortKey& key1, const SortKey& key2) const
+{
+    if (key1.createTime != key2.createTime)
+    {
+        return m_descending ? (key1.createTime > key2.createTime) : (key1.createTime < key2.createTime);
+    }
+    return m_descending ? (key1.rowid > key2.rowid) : (key1.rowid < key2.rowid);
+}
+
+bool MessageReader::isRunAfter(size_t run1, size_t run2) const
+{
+    return isBefore(m_runs[run2].keys[m_runs[run2].position], m_runs[run1].keys[m_runs[run1].position]);
+}
+
+void MessageReader::readRecord(MsgRecord& record) const
+{
+    record.createTime = sqlite3_column_int(m_stmt, 0);
+    const unsigned char* pMessage = sqlite3_column_text(m_stmt, 1);
+    if (pMessage != NULL)
+    {
+        record.message.assign(reinterpret_cast<const char*>(pMessage), sqlite3_column_bytes(m_stmt, 1));
+    }
+    else
+    {
+        record.message.clear();
+    }
+    record.des = sqlite3_column_int(m_stmt, 2);
+    record.type = sqlite3_column_int(m_stmt, 3);
+    record.msgId = sqlite3_column_int(m_stmt, 4);
+}
@@ -0,0 +1,137 @@
+//
+//  MessageReader.h
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+
+#ifndef MessageReader_h
+#define MessageReader_h
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+struct sqlite3_stmt;
+struct MsgRecord;
+class SqliteConnection;
+
+enum MessageReadingPath
+{
+    MRP_ROWID = 0,      // The table is in the order of CreateTime already, the rows are streamed by rowid
+    MRP_SORTED,         // Rows out of order, sorted by an external merge sort of (CreateTime, rowid) and read one by one
+    MRP_RANGES,         // In rowid order, ranges of rowids read by several connections in parallel (SessionParser)
+
+    MRP_MAX
+};
+
+// Reads the messages of a Chat_ table in the order of CreateTime without ORDER BY CreateTime,
+// which makes SQLite sort the whole table in a temporary b-tree as CreateTime has no index
+//
+// Messages are inserted as they come, so rowid (MesLocalID) almost always follows CreateTime:
+// a first pass reads CreateTime in rowid order, which doesn't touch the overflow pages of the messages,
+// and if it never goes back, the rows are streamed in rowid order
+// Otherwise the keys are sorted in runs of a bounded size, which are spilled to temporary files if there are more than one,
+// and merged, and every row is read by its rowid
+// Ties of CreateTime are in the order of rowid
+class MessageReader
+{
+public:
+    typedef std::function<void(sqlite3_stmt*)> ParameterBinder;
+
+    class Statistics
+    {
+    protected:
+        std::atomic<uint64_t> m_sessions[MRP_MAX];
+        std::atomic<uint64_t> m_rows[MRP_MAX];
+        std::atomic<uint64_t> m_spilledRuns;
+
+    public:
+        Statistics();
+        void add(MessageReadingPath path, uint64_t rows, uint64_t spilledRuns);
+        // e.g.: "rowid order: 120 chats, 350000 rows; sorted: 2 chats, 8000 rows, 0 spilled runs"
+        std::string toString() const;
+    };
+
+protected:
+    struct SortKey
+    {
+        int64_t rowid;
+        int createTime;
+    };
+
+    struct Run
+    {
+        FILE* file;                     // NULL if the run is kept in memory
+        std::vector<SortKey> keys;      // The run or the buffer of the file
+        size_t position;
+
+        Run() : file(NULL), position(0)
+        {
+        }
+    };
+
+    SqliteConnection& m_connection;
+    std::string m_table;
+    bool m_descending;
+    MessageReadingPath m_path;
+    sqlite3_stmt* m_stmt;
+    std::vector<Run> m_runs;
+    std::vector<size_t> m_heap;         // Indexes of the runs which have keys, by their current keys
+    uint64_t m_numberOfRows;
+    uint64_t m_numberOfSpilledRuns;
+    size_t m_maxKeysInMemory;
+    bool m_checkingOrder;
+    Statistics* m_statistics;
+
+public:
+    static const size_t DEFAULT_MAX_KEYS_IN_MEMORY = 1024 * 1024;
+
+    // The statements are prepared through the cache of the connection
+    MessageReader(SqliteConnection& connection, const std::string& table, bool descending);
+    ~MessageReader();
+
+    void setStatistics(Statistics* statistics)
+    {
+        m_statistics = statistics;
+    }
+    // Keys of a run, 16 bytes each
+    void setMaxKeysInMemory(size_t maxKeysInMemory)
+    {
+        m_maxKeysInMemory = maxKeysInMemory < 2 ? 2 : maxKeysInMemory;
+    }
+
+    // The caller knows that the rows are in order, e.g.: a range of a table which is checked already
+    void setCheckingOrder(bool checkingOrder)
+    {
+        m_checkingOrder = checkingOrder;
+    }
+
+    // conditions: the WHERE clause without WHERE, empty for all rows; binder binds its parameters, which is called for every query of the table
+    bool open(const std::string& conditions, const ParameterBinder& binder);
+    // Columns: CreateTime, Message, Des, Type, MesLocalID
+    bool next(MsgRecord& record);
+    void close();
+
+    MessageReadingPath getPath() const
+    {
+        return m_path;
+    }
+
+protected:
+    sqlite3_stmt* prepare(const std::string& sql, const ParameterBinder& binder) const;
+    bool checkOrder(const std::string& whereClause, const ParameterBinder& binder, bool& inOrder) const;
+    bool sortKeys(const std::string& whereClause, const ParameterBinder& binder);
+    void addRun(std::vector<SortKey>& keys, bool spilling);
+    bool fillRun(Run& run);
+    bool isBefore(const SortKey& key1, const SortKey& key2) const;
+    // Heap order of the std algorithms, which put the largest first: the run with the earliest current key wins
+    bool isRunAfter(size_t run1, size_t run2) const;
+    void readRecord(MsgRecord& record) const;
+};
+
+#endif /* MessageReader_h */
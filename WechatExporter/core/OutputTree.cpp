@@ -0,0 +1,162 @@
+//
+//  OutputTree.cpp
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+
+#include "OutputTree.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+#include "OSDef.h"
+#include "Utils.h"
+
+#ifndef O_DIRECTORY
+#define O_DIRECTORY 0
+#endif
+
+OutputDirectory::~OutputDirectory()
+{
+#ifndef _WIN32
+    if (m_fd != -1)
+    {
+        close(m_fd);
+    }
+#endif
+}
+
+OutputTree::OutputTree(const Shell& shell) : m_shell(shell)
+{
+}
+
+bool OutputTree::ensureDirectory(const std::string& path)
+{
+    std::string directory = normalizeDirectory(path);
+    std::unique_lock<std::mutex> lock(m_mtx);
+    return ensureDirectoryImpl(directory, lock);
+}
+
+OutputTree::DirectoryPtr OutputTree::openParentDirectory(const std::string& filePath, std::string& fileName)
+{
+    std::string path = normalizePath(filePath);
+    std::string::size_type pos = path.find_last_of(DIR_SEP);
+    if (pos == std::string::npos)
+    {
+        fileName = path;
+        return DirectoryPtr();
+    }
+    std::string directory = (pos == 0) ? path.substr(0, 1) : path.substr(0, pos);
+    fileName = path.substr(pos + 1);
+
+    std::unique_lock<std::mutex> lock(m_mtx);
+    if (!ensureDirectoryImpl(directory, lock))
+    {
+        return DirectoryPtr();
+    }
+    return openDirectory(directory, lock);
+}
+
+void OutputTree::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_directories.clear();
+    m_openDirectoryIndex.clear();
+    m_openDirectories.clear();
+}
+
+std::string OutputTree::normalizeDirectory(const std::string& path)
+{
+    std::string directory = normalizePath(path);
+    while (directory.size() > 1 && directory.back() == DIR_SEP)
+    {
+        directory.pop_back();
+    }
+    return directory;
+}
+
+bool OutputTree::ensureDirectoryImpl(const std::string& path, std::unique_lock<std::mutex>& lock)
+{
+    if (m_directories.find(path) != m_directories.cend())
+    {
+        return true;
+    }
+
+#ifndef _WIN32
+    std::string::size_type pos = path.find_last_of(DIR_SEP);
+    if (pos != std::string::npos && pos > 0 && pos + 1 < path.size())
+    {
+        std::string parent = path.substr(0, pos);
+        if (m_directories.find(parent) != m_directories.cend())
+        {
+            // The parent is known, one mkdirat without resolving the path, e.g.: <session>_files/<msgId>
+            DirectoryPtr parentDirectory = openDirectory(parent, lock);
+            if (parentDirectory)
+            {
+                std::string name = path.substr(pos + 1);
+                if (mkdirat(parentDirectory->getFd(), name.c_str(), 0755) == 0 || errno == EEXIST)
+                {
+                    m_directories.insert(path);
+                    return true;
+                }
+            }
+        }
+    }
+#endif
+
+    if (!m_shell.makeDirectory(path) && !m_shell.existsDirectory(path))
+    {
+        return false;
+    }
+    markDirectory(path);
+    return true;
+}
+
+OutputTree::DirectoryPtr OutputTree::openDirectory(const std::string& path, std::unique_lock<std::mutex>& /*lock*/)
+{
+#ifdef _WIN32
+    return DirectoryPtr();
+#else
+    std::unordered_map<std::string, std::list<std::pair<std::string, DirectoryPtr>>::iterator>::iterator it = m_openDirectoryIndex.find(path);
+    if (it != m_openDirectoryIndex.end())
+    {
+        m_openDirectories.splice(m_openDirectories.begin(), m_openDirectories, it->second);
+        return it->second->second;
+    }
+
+    int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return DirectoryPtr();
+    }
+    DirectoryPtr directory = std::make_shared<OutputDirectory>(fd);
+    m_openDirectories.emplace_front(path, directory);
+    m_openDirectoryIndex[path] = m_openDirectories.begin();
+    if (m_openDirectories.size() > MAX_OPEN_DIRECTORIES)
+    {
+        // Closed when the last user releases it
+        m_openDirectoryIndex.erase(m_openDirectories.back().first);
+        m_openDirectories.pop_back();
+    }
+    return directory;
+#endif
+}
+
+void OutputTree::markDirectory(const std::string& path)
+{
+    // The parents exist too
+    std::string::size_type pos = path.size();
+    while (pos != std::string::npos && pos > 0)
+    {
+        if (!m_directories.insert(path.substr(0, pos)).second)
+        {
+            break;
+        }
+        pos = path.find_last_of(DIR_SEP, pos - 1);
+    }
+}
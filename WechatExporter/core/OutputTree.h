@@ -0,0 +1,80 @@
+//
+//  OutputTree.h
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+
+#ifndef OutputTree_h
+#define OutputTree_h
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <mutex>
+#include "Shell.h"
+
+// Directory of the output tree which is kept open, so files in it are created with openat/linkat... without
+// resolving the full path again
+class OutputDirectory
+{
+protected:
+    int m_fd;
+
+public:
+    explicit OutputDirectory(int fd) : m_fd(fd)
+    {
+    }
+    ~OutputDirectory();
+
+    int getFd() const
+    {
+        return m_fd;
+    }
+
+private:
+    OutputDirectory(const OutputDirectory&);
+    OutputDirectory& operator=(const OutputDirectory&);
+};
+
+// Remembers the directories of the output which exist, so there is no syscall for a known directory,
+// and creates the missing ones with mkdirat under the open parent
+// The descriptors of the recently used directories are kept open, up to MAX_OPEN_DIRECTORIES
+// Windows has no descriptors of directories, only the existence is cached there
+// Thread-safe
+class OutputTree
+{
+public:
+    typedef std::shared_ptr<const OutputDirectory> DirectoryPtr;
+
+    static const size_t MAX_OPEN_DIRECTORIES = 128;
+
+protected:
+    const Shell& m_shell;
+
+    mutable std::mutex m_mtx;
+    std::unordered_set<std::string> m_directories;
+    // Most recently used first
+    std::list<std::pair<std::string, DirectoryPtr>> m_openDirectories;
+    std::unordered_map<std::string, std::list<std::pair<std::string, DirectoryPtr>>::iterator> m_openDirectoryIndex;
+
+public:
+    explicit OutputTree(const Shell& shell);
+
+    bool ensureDirectory(const std::string& path);
+    // Makes sure the folder of the file exists and returns it open, or NULL
+    DirectoryPtr openParentDirectory(const std::string& filePath, std::string& fileName);
+
+    void clear();
+
+protected:
+    static std::string normalizeDirectory(const std::string& path);
+    bool ensureDirectoryImpl(const std::string& path, std::unique_lock<std::mutex>& lock);
+    DirectoryPtr openDirectory(const std::string& path, std::unique_lock<std::mutex>& lock);
+    void markDirectory(const std::string& path);
+};
+
+#endif /* OutputTree_h */
@@ -0,0 +1,371 @@
+//
+//  SessionPageWriter.cpp
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+
+#include "SessionPageWriter.h"
+#ifdef _WIN32
+#include <atlstr.h>
+#endif
+#include "Utils.h"
+#include <cstring>
+
+// Large enough to turn the writes of small messages into a few big ones
+#define PAGE_WRITER_BUFFER_SIZE   (1024 * 1024)
+
+static FILE* openFileForWriting(const std::string& path, std::vector<char>& buffer)
+{
+#ifdef _WIN32
+    CA2W pszW(path.c_str(), CP_UTF8);
+    FILE* file = _wfopen(pszW, L"wb");
+#else
+    FILE* file = fopen(path.c_str(), "wb");
+#endif
+    if (NULL != file)
+    {
+        buffer.resize(PAGE_WRITER_BUFFER_SIZE);
+        setvbuf(file, &buffer[0], _IOFBF, buffer.size());
+    }
+    return file;
+}
+
+static std::string getTempPath(const std::string& path)
+{
+    return path + ".tmp";
+}
+
+static bool renameTempFile(const std::string& path)
+{
+    return replaceFile(getTempPath(path), path);
+}
+
+SessionPageWriter::SessionPageWriter(const std::string& path, const Template& frame, const TemplateValues& frameValues, size_t numberOfInlineMessages) : m_path(path), m_frame(frame), m_frameValues(frameValues), m_numberOfInlineMessages(numberOfInlineMessages), m_file(NULL), m_numberOfMessages(0), m_failed(false), m_paged(false), m_shardFile(NULL), m_numberOfShards(0), m_numberOfMessagesInShard(0), m_shardLength(0), m_resumed(false)
+{
+    m_bodyIndex = m_frame.findPlaceholder(TK_BODY);
+    m_jsonIndex = m_frame.findPlaceholder(TK_JSONDATA);
+    if (m_jsonIndex >= m_frame.getNumberOfSegments() || m_jsonIndex < m_bodyIndex)
+    {
+        // No place for the json data in the frame, e.g.: text mode
+        m_numberOfInlineMessages = NO_PAGING;
+    }
+}
+
+SessionPageWriter::~SessionPageWriter()
+{
+    // Not closed, e.g.: the export is cancelled, the incomplete files are dropped
+    if (NULL != m_shardFile)
+    {
+        fclose(m_shardFile);
+        m_shardFile = NULL;
+        deleteFile(getTempPath(m_shardPath));
+    }
+    if (NULL != m_file)
+    {
+        fclose(m_file);
+        m_file = NULL;
+        deleteFile(getTempPath(m_path));
+    }
+    for (std::vector<std::string>::const_iterator it = m_completedShards.cbegin(); it != m_completedShards.cend(); ++it)
+    {
+        deleteFile(getTempPath(*it));
+    }
+}
+
+void SessionPageWriter::setPaging(const std::string& pathPrefix, const std::string& urlPrefix)
+{
+    if (m_numberOfInlineMessages != NO_PAGING && m_numberOfInlineMessages > 0)
+    {
+        m_paged = true;
+        m_shardPathPrefix = pathPrefix;
+        m_shardUrlPrefix = urlPrefix;
+    }
+}
+
+bool SessionPageWriter::resume(const SessionPageLayout& layout)
+{
+    if (!m_paged || layout.pageSize != m_numberOfInlineMessages || layout.numberOfMessagesInLastShard > layout.pageSize || NULL != m_file)
+    {
+        return false;
+    }
+    m_resumed = true;
+    m_numberOfMessages = layout.numberOfMessages;
+    m_numberOfShards = layout.numberOfShards;
+    m_numberOfMessagesInShard = (layout.numberOfShards > 0) ? layout.numberOfMessagesInLastShard : 0;
+    m_shardLength = (layout.numberOfShards > 0) ? layout.lastShardLength : 0;
+    return true;
+}
+
+void SessionPageWriter::getLayout(SessionPageLayout& layout) const
+{
+    layout.pageSize = m_numberOfInlineMessages;
+    layout.numberOfMessages = m_numberOfMessages;
+    layout.numberOfShards = m_numberOfShards;
+    layout.numberOfMessagesInLastShard = m_numberOfMessagesInShard;
+    layout.lastShardLength = m_shardLength;
+}
+
+bool SessionPageWriter::open()
+{
+    m_file = openFileForWriting(getTempPath(m_path), m_fileBuffer);
+    if (NULL == m_file)
+    {
+        m_failed = true;
+        return false;
+    }
+
+    m_buffer.clear();
+    m_frame.render(m_frameValues, 0, m_bodyIndex, m_buffer);
+    return flushBuffer(m_file);
+}
+
+bool SessionPageWriter::write(const std::string& message)
+{
+    if (m_failed)
+    {
+        return false;
+    }
+    if (!m_resumed && NULL == m_file && !open())
+    {
+        return false;
+    }
+
+    // The page of a resumed session is left as it is, even if it has room for more messages
+    if (!m_resumed && m_numberOfMessages < m_numberOfInlineMessages)
+    {
+        m_numberOfMessages++;
+        m_failed = fwrite(message.c_str(), 1, message.size(), m_file) != message.size();
+        return !m_failed;
+    }
+
+    m_buffer.clear();
+    if (m_paged)
+    {
+        if (NULL == m_shardFile)
+        {
+            if (!openShard())
+            {
+                return false;
+            }
+        }
+        else
+        {
+            m_buffer.push_back(',');
+        }
+        appendJsonString(message, m_buffer);
+        m_numberOfMessages++;
+        if (!flushBuffer(m_shardFile))
+        {
+            return false;
+        }
+        m_shardLength += m_buffer.size();
+        return (++m_numberOfMessagesInShard < m_numberOfInlineMessages) || closeShard();
+    }
+
+    if (m_numberOfMessages == m_numberOfInlineMessages)
+    {
+        m_frame.render(m_frameValues, m_bodyIndex + 1, m_jsonIndex, m_buffer);
+        m_buffer.push_back('[');
+    }
+    else
+    {
+        m_buffer.push_back(',');
+    }
+    appendJsonString(message, m_buffer);
+    m_numberOfMessages++;
+
+    return flushBuffer(m_file);
+}
+
+bool SessionPageWriter::close()
+{
+    if (NULL == m_file && !m_resumed)
+    {
+        return !m_failed;
+    }
+
+    std::string manifestUrl = "null";
+    if (m_paged)
+    {
+        closeShard();
+        if (renameCompletedShards())
+        {
+            writeManifest(manifestUrl);
+        }
+    }
+    if (m_resumed)
+    {
+        return !m_failed;
+    }
+    m_frameValues[TK_PAGEMANIFEST] = manifestUrl;
+
+    m_buffer.clear();
+    if (m_numberOfInlineMessages == NO_PAGING)
+    {
+        m_frame.render(m_frameValues, m_bodyIndex + 1, m_frame.getNumberOfSegments(), m_buffer);
+    }
+    else
+    {
+        if (m_paged || m_numberOfMessages <= m_numberOfInlineMessages)
+        {
+            m_frame.render(m_frameValues, m_bodyIndex + 1, m_jsonIndex, m_buffer);
+            m_buffer.push_back('[');
+        }
+        m_buffer.push_back(']');
+        m_frame.render(m_frameValues, m_jsonIndex + 1, m_frame.getNumberOfSegments(), m_buffer);
+    }
+    flushBuffer(m_file);
+
+    if (fclose(m_file) != 0)
+    {
+        m_failed = true;
+    }
+    m_file = NULL;
+
+    if (m_failed || !renameTempFile(m_path))
+    {
+        deleteFile(getTempPath(m_path));
+        m_failed = true;
+    }
+    return !m_failed;
+}
+
+bool SessionPageWriter::flushBuffer(FILE* file)
+{
+    if (!m_failed && !m_buffer.empty())
+    {
+        m_failed = fwrite(m_buffer.c_str(), 1, m_buffer.size(), file) != m_buffer.size();
+    }
+    return !m_failed;
+}
+
+std::string SessionPageWriter::getShardName(unsigned int index) const
+{
+    char suffix[24] = { 0 };
+    snprintf(suffix, sizeof(suffix), ".p%04u.js", index);
+    return suffix;
+}
+
+bool SessionPageWriter::openShard()
+{
+    if (m_numberOfShards > 0 && m_numberOfMessagesInShard > 0 && m_numberOfMessagesInShard < m_numberOfInlineMessages)
+    {
+        // The last shard of the previous export has room, or a new shard follows it if it can't be appended
+        if (reopenLastShard())
+        {
+            return true;
+        }
+    }
+
+    m_numberOfShards++;
+    m_numberOfMessagesInShard = 0;
+    m_shardLength = 0;
+    m_shardPath = m_shardPathPrefix + getShardName(m_numberOfShards);
+    m_shardFile = openFileForWriting(getTempPath(m_shardPath), m_shardFileBuffer);
+    if (NULL == m_shardFile)
+    {
+        m_failed = true;
+        return false;
+    }
+
+    m_buffer.append("onWechatPage(" + std::to_string(m_numberOfShards) + ",[");
+    return true;
+}
+
+bool SessionPageWriter::reopenLastShard()
+{
+    static const char trailer[] = "]);\n";
+    const size_t trailerLength = sizeof(trailer) - 1;
+
+    // The shard is copied up to the length in the layout and replaced on closing, instead of being appended in place
+    // The file can be longer: a killed export may have renamed the shard before its layout reached the export manifest,
+    // and those messages are written again
+    std::vector<unsigned char> data;
+    std::string path = m_shardPathPrefix + getShardName(m_numberOfShards);
+    if (m_shardLength == 0 || !readFile(path, data) || data.size() < m_shardLength + trailerLength || memcmp(&data[data.size() - trailerLength], trailer, trailerLength) != 0 ||
+        (data[m_shardLength] != trailer[0] && data[m_shardLength] != ','))
+    {
+        return false;
+    }
+
+    m_shardPath = path;
+    m_shardFile = openFileForWriting(getTempPath(m_shardPath), m_shardFileBuffer);
+    if (NULL == m_shardFile)
+    {
+        return false;
+    }
+    if (fwrite(&data[0], 1, m_shardLength, m_shardFile) != m_shardLength)
+    {
+        fclose(m_shardFile);
+        m_shardFile = NULL;
+        deleteFile(getTempPath(m_shardPath));
+        return false;
+    }
+
+    m_buffer.push_back(',');
+    return true;
+}
+
+bool SessionPageWriter::closeShard()
+{
+    if (NULL == m_shardFile)
+    {
+        return !m_failed;
+    }
+
+    m_buffer.clear();
+    m_buffer.append("]);\n");
+    flushBuffer(m_shardFile);
+    if (fclose(m_shardFile) != 0)
+    {
+        m_failed = true;
+    }
+    m_shardFile = NULL;
+    m_completedShards.push_back(m_shardPath);
+    return !m_failed;
+}
+
+bool SessionPageWriter::renameCompletedShards()
+{
+    for (std::vector<std::string>::const_iterator it = m_completedShards.cbegin(); !m_failed && it != m_completedShards.cend(); ++it)
+    {
+        m_failed = !renameTempFile(*it);
+    }
+    if (m_failed)
+    {
+        for (std::vector<std::string>::const_iterator it = m_completedShards.cbegin(); it != m_completedShards.cend(); ++it)
+        {
+            deleteFile(getTempPath(*it));
+        }
+    }
+    m_completedShards.clear();
+    return !m_failed;
+}
+
+bool SessionPageWriter::writeManifest(std::string& manifestUrl)
+{
+    std::string manifest = "onWechatPageManifest({\"pageSize\":" + std::to_string(m_numberOfInlineMessages) + ",\"messages\":" + std::to_string(m_numberOfMessages) + ",\"pages\":[";
+    for (unsigned int index = 1; index <= m_numberOfShards; ++index)
+    {
+        if (index > 1)
+        {
+            manifest.push_back(',');
+        }
+        appendJsonString(m_shardUrlPrefix + getShardName(index), manifest);
+    }
+    manifest.append("]});\n");
+
+    std::string path = m_shardPathPrefix + ".pages.js";
+    if (!writeFile(getTempPath(path), manifest) || !renameTempFile(path))
+    {
+        deleteFile(getTempPath(path));
+        m_failed = true;
+        return false;
+    }
+
+    manifestUrl.clear();
+    appendJsonString(m_shardUrlPrefix + ".pages.js", manifestUrl);
+    return true;
+}
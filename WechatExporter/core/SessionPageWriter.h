@@ -0,0 +1,119 @@
+//
+//  SessionPageWriter.h
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+
+#ifndef SessionPageWriter_h
+#define SessionPageWriter_h
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "TemplateValues.h"
+
+// Streams the page of a session to the file:
+//   frame before %%BODY%%
+//   the first messages, inline
+//   frame between %%BODY%% and %%JSONDATA%%
+//   the rest of the messages, as a json array of strings which is loaded on scrolling
+//   frame after %%JSONDATA%%
+// The file is created on the first message, so there is no page for a session without messages
+// Memory doesn't depend on the number of messages
+//
+// In paged mode, the rest of the messages are written to shards of the same size instead of the json array:
+//   <session>.p0001.js, <session>.p0002.js ...: onWechatPage(index, [messages]);
+//   <session>.pages.js: onWechatPageManifest({"pageSize": 1000, "messages": 12345, "pages": ["<session>.p0001.js", ...]});
+// and %%PAGEMANIFEST%% of the frame is the url of the manifest, which the frame loads the shards from on scrolling
+// The manifest is written even if there is no shard, so new messages can be appended to the shards later
+// without touching the page (resume)
+//
+// Every file is written to <file>.tmp and they are all renamed on closing, so a killed export never leaves
+// a truncated page or shard behind, nor shards which don't match the manifest: the previous ones, if any, stay as they are
+
+// Where a paged session stops, saved by the export manifest for appending to it later
+struct SessionPageLayout
+{
+    size_t pageSize;
+    size_t numberOfMessages;
+    unsigned int numberOfShards;
+    size_t numberOfMessagesInLastShard;
+    size_t lastShardLength;     // Bytes of the last shard without its trailer, a longer file is truncated on appending
+
+    SessionPageLayout() : pageSize(0), numberOfMessages(0), numberOfShards(0), numberOfMessagesInLastShard(0), lastShardLength(0)
+    {
+    }
+};
+
+class SessionPageWriter
+{
+public:
+    static const size_t NO_PAGING = (size_t)(-1);
+
+protected:
+    std::string m_path;
+    const Template& m_frame;
+    TemplateValues m_frameValues;
+    size_t m_numberOfInlineMessages;
+
+    size_t m_bodyIndex;
+    size_t m_jsonIndex;
+
+    FILE* m_file;
+    std::vector<char> m_fileBuffer;
+    std::string m_buffer;
+    size_t m_numberOfMessages;
+    bool m_failed;
+
+    bool m_paged;
+    std::string m_shardPathPrefix;
+    std::string m_shardUrlPrefix;
+    std::string m_shardPath;
+    std::vector<std::string> m_completedShards;   // Written to the temporary files, renamed on closing
+    FILE* m_shardFile;
+    std::vector<char> m_shardFileBuffer;
+    unsigned int m_numberOfShards;
+    size_t m_numberOfMessagesInShard;
+    size_t m_shardLength;
+    bool m_resumed;
+
+public:
+    // frameValues: values of the frame except %%BODY%% and %%JSONDATA%%
+    // numberOfInlineMessages: NO_PAGING to write all messages inline
+    SessionPageWriter(const std::string& path, const Template& frame, const TemplateValues& frameValues, size_t numberOfInlineMessages);
+    ~SessionPageWriter();
+
+    // pathPrefix: path of the page without the extension name, urlPrefix: its url relative to the page
+    void setPaging(const std::string& pathPrefix, const std::string& urlPrefix);
+    // Appends the messages to the shards of the previous export instead of writing the page, paging is required
+    // False if the layout doesn't match, the page is written from scratch then
+    bool resume(const SessionPageLayout& layout);
+    bool isResumed() const
+    {
+        return m_resumed;
+    }
+    void getLayout(SessionPageLayout& layout) const;
+
+    bool write(const std::string& message);
+    // Writes the rest of the frame and closes the file
+    bool close();
+
+    size_t getNumberOfMessages() const
+    {
+        return m_numberOfMessages;
+    }
+
+protected:
+    bool open();
+    bool flushBuffer(FILE* file);
+    bool openShard();
+    bool reopenLastShard();
+    bool closeShard();
+    bool writeManifest(std::string& manifestUrl);
+    bool renameCompletedShards();
+    std::string getShardName(unsigned int index) const;
+};
+
+#endif /* SessionPageWriter_h */
@@ -0,0 +1,134 @@
+//
+//  SqliteConnectionPool.cpp
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+
+#include "SqliteConnectionPool.h"
+#include <sqlite3.h>
+#include "Utils.h"
+
+SqliteConnection::~SqliteConnection()
+{
+    for (std::unordered_map<std::string, sqlite3_stmt*>::iterator it = m_statements.begin(); it != m_statements.end(); ++it)
+    {
+        sqlite3_finalize(it->second);
+    }
+    m_statements.clear();
+    sqlite3_close(m_db);
+}
+
+sqlite3_stmt* SqliteConnection::prepare(const std::string& sql)
+{
+    std::unordered_map<std::string, sqlite3_stmt*>::iterator it = m_statements.find(sql);
+    if (it != m_statements.end())
+    {
+        sqlite3_reset(it->second);
+        sqlite3_clear_bindings(it->second);
+        return it->second;
+    }
+
+    sqlite3_stmt* stmt = NULL;
+    if (sqlite3_prepare_v3(m_db, sql.c_str(), (int)(sql.size()), SQLITE_PREPARE_PERSISTENT, &stmt, NULL) != SQLITE_OK)
+    {
+        sqlite3_finalize(stmt);
+        return NULL;
+    }
+    m_statements[sql] = stmt;
+    return stmt;
+}
+
+void SqliteConnection::reset(sqlite3_stmt* stmt)
+{
+    if (NULL != stmt)
+    {
+        sqlite3_reset(stmt);
+    }
+}
+
+void SqliteConnection::resetAll()
+{
+    // Nobody holds the statements now, so the cache is trimmed here rather than in prepare
+    bool trimming = m_statements.size() > MAX_STATEMENTS;
+    for (std::unordered_map<std::string, sqlite3_stmt*>::iterator it = m_statements.begin(); it != m_statements.end(); ++it)
+    {
+        if (trimming)
+        {
+            sqlite3_finalize(it->second);
+        }
+        else
+        {
+            sqlite3_reset(it->second);
+        }
+    }
+    if (trimming)
+    {
+        m_statements.clear();
+    }
+}
+
+SqliteConnectionPool::SqliteConnectionPool()
+{
+}
+
+SqliteConnectionPool::~SqliteConnectionPool()
+{
+    clear();
+}
+
+SqliteConnectionPool::ConnectionPtr SqliteConnectionPool::acquire(const std::string& path)
+{
+    SqliteConnection* connection = NULL;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        std::map<std::string, std::vector<SqliteConnection*>>::iterator it = m_idleConnections.find(path);
+        if (it != m_idleConnections.end() && !it->second.empty())
+        {
+            connection = it->second.back();
+            it->second.pop_back();
+        }
+    }
+
+    if (NULL == connection)
+    {
+        sqlite3* db = NULL;
+        if (openSqlite3ReadOnly(path, &db, m_vfs.empty() ? NULL : m_vfs.c_str()) != SQLITE_OK)
+        {
+            sqlite3_close(db);
+            return ConnectionPtr();
+        }
+        connection = new SqliteConnection(db);
+    }
+
+    return ConnectionPtr(connection, [this, path](SqliteConnection* c) { release(path, c); });
+}
+
+void SqliteConnectionPool::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    for (std::map<std::string, std::vector<SqliteConnection*>>::iterator it = m_idleConnections.begin(); it != m_idleConnections.end(); ++it)
+    {
+        for (std::vector<SqliteConnection*>::iterator itConn = it->second.begin(); itConn != it->second.end(); ++itConn)
+        {
+            delete *itConn;
+        }
+    }
+    m_idleConnections.clear();
+}
+
+void SqliteConnectionPool::release(const std::string& path, SqliteConnection* connection)
+{
+    connection->resetAll();
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        std::vector<SqliteConnection*>& connections = m_idleConnections[path];
+        if (connections.size() < MAX_IDLE_CONNECTIONS)
+        {
+            connections.push_back(connection);
+            return;
+        }
+    }
+    delete connection;
+}
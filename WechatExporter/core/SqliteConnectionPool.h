@@ -0,0 +1,96 @@
+//
+//  SqliteConnectionPool.h
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+
+#ifndef SqliteConnectionPool_h
+#define SqliteConnectionPool_h
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+// Read-only connection (openSqlite3ReadOnly) with the statements it has prepared, keyed by their sql
+// A statement from prepare is reset with its bindings cleared, and it goes back to the cache with reset
+// Used by one thread at a time
+class SqliteConnection
+{
+protected:
+    sqlite3* m_db;
+    std::unordered_map<std::string, sqlite3_stmt*> m_statements;
+
+public:
+    static const size_t MAX_STATEMENTS = 32;
+
+    explicit SqliteConnection(sqlite3* db) : m_db(db)
+    {
+    }
+    ~SqliteConnection();
+
+    sqlite3* getDb() const
+    {
+        return m_db;
+    }
+
+    // NULL if the sql can't be prepared
+    sqlite3_stmt* prepare(const std::string& sql);
+    // Ends the statement, so it doesn't keep the read transaction open in the pool
+    void reset(sqlite3_stmt* stmt);
+    // Resets all statements before the connection goes back to the pool, and drops them if there are more than MAX_STATEMENTS
+    void resetAll();
+
+private:
+    SqliteConnection(const SqliteConnection&);
+    SqliteConnection& operator=(const SqliteConnection&);
+};
+
+// Connections to the databases of the backup, which are opened immutable, so they can be reused as long as the pool lives:
+// the schema is parsed and the statements are prepared once per connection instead of once per session
+// A connection is lent to one user at a time and returns to the pool when its pointer is released,
+// so parallel readers of the same file get connections of their own
+// Up to MAX_IDLE_CONNECTIONS connections per file are kept, the pool must outlive the connections it lends
+// Thread-safe
+class SqliteConnectionPool
+{
+public:
+    typedef std::shared_ptr<SqliteConnection> ConnectionPtr;
+
+    static const size_t MAX_IDLE_CONNECTIONS = 8;
+
+protected:
+    std::mutex m_mtx;
+    std::map<std::string, std::vector<SqliteConnection*>> m_idleConnections;
+    std::string m_vfs;
+
+public:
+    SqliteConnectionPool();
+    ~SqliteConnectionPool();
+
+    // The VFS of the backup (ITunesDb::getVfsName), set it before the connections are acquired
+    void setVfs(const char* vfs)
+    {
+        m_vfs = NULL == vfs ? "" : vfs;
+    }
+
+    // NULL if the database can't be opened
+    ConnectionPtr acquire(const std::string& path);
+    void clear();
+
+protected:
+    void release(const std::string& path, SqliteConnection* connection);
+
+private:
+    SqliteConnectionPool(const SqliteConnectionPool&);
+    SqliteConnectionPool& operator=(const SqliteConnectionPool&);
+};
+
+#endif /* SqliteConnectionPool_h */
@@ -0,0 +1,308 @@
+//
+//  TemplateValues.h
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+
+#ifndef TemplateValues_h
+#define TemplateValues_h
+
+#include <string>
+#include <vector>
+#include <cstring>
+
+// Placeholders of the message templates, e.g.: TK_MESSAGE => %%MESSAGE%%
+enum TemplateKey
+{
+    TK_MSGID = 0,
+    TK_NAME,
+    TK_TIME,
+    TK_MESSAGE,
+    TK_ALIGNMENT,
+    TK_AVATAR,
+    TK_EXTRA_CLS,
+    TK_AUDIOPATH,
+    TK_EMOJIPATH,
+    TK_IMGPATH,
+    TK_IMGTHUMBPATH,
+    TK_THUMBPATH,
+    TK_VIDEOPATH,
+    TK_SHARINGIMGPATH,
+    TK_SHARINGURL,
+    TK_SHARINGTITLE,
+    TK_CARDNAME,
+    TK_CARDIMGPATH,
+    // frame and list
+    TK_DISPLAYNAME,
+    TK_BODY,
+    TK_JSONDATA,
+    TK_ITEMPICPATH,
+    TK_ITEMLINK,
+    TK_ITEMTEXT,
+    TK_USERNAME,
+    TK_TBODY,
+    TK_PAGEMANIFEST,
+
+    TK_MAX
+};
+
+inline const char* getTemplateKeyName(TemplateKey key)
+{
+    static const char* names[TK_MAX] = {
+        "%%MSGID%%", "%%NAME%%", "%%TIME%%", "%%MESSAGE%%", "%%ALIGNMENT%%", "%%AVATAR%%", "%%EXTRA_CLS%%",
+        "%%AUDIOPATH%%", "%%EMOJIPATH%%", "%%IMGPATH%%", "%%IMGTHUMBPATH%%", "%%THUMBPATH%%", "%%VIDEOPATH%%",
+        "%%SHARINGIMGPATH%%", "%%SHARINGURL%%", "%%SHARINGTITLE%%", "%%CARDNAME%%", "%%CARDIMGPATH%%",
+        "%%DISPLAYNAME%%", "%%BODY%%", "%%JSONDATA%%", "%%ITEMPICPATH%%", "%%ITEMLINK%%", "%%ITEMTEXT%%", "%%USERNAME%%", "%%TBODY%%",
+        "%%PAGEMANIFEST%%"
+    };
+    return (key >= 0 && key < TK_MAX) ? names[key] : "";
+}
+
+// name: the placeholder with the leading and trailing %%, e.g.: "%%MESSAGE%%"
+// Returns TK_MAX for the unknown ones
+inline TemplateKey findTemplateKey(const char* name, size_t length)
+{
+    for (int key = 0; key < TK_MAX; ++key)
+    {
+        const char* keyName = getTemplateKeyName((TemplateKey)key);
+        if (strlen(keyName) == length && strncmp(keyName, name, length) == 0)
+        {
+            return (TemplateKey)key;
+        }
+    }
+    return TK_MAX;
+}
+
+// Values are kept in a fixed array of slots instead of a map.
+// clear() only resets the lengths, so short values stay in the inline buffer of std::string
+// and longer ones reuse the capacity of the previous row
+class TemplateValues
+{
+private:
+    std::string m_name;
+    std::string m_values[TK_MAX];
+    unsigned int m_flags;   // 1 << key for the slots which have values
+
+public:
+    TemplateValues() : m_flags(0)
+    {
+    }
+    TemplateValues(const std::string& name) : m_name(name), m_flags(0)
+    {
+    }
+    const std::string& getName() const
+    {
+        return m_name;
+    }
+    void setName(const char* name)
+    {
+        m_name.assign(name);
+    }
+    void setName(const std::string& name)
+    {
+        m_name.assign(name);
+    }
+    std::string& operator[](TemplateKey key)
+    {
+        m_flags |= (1u << key);
+        return m_values[key];
+    }
+    const std::string& getValue(TemplateKey key) const
+    {
+        return m_values[key];
+    }
+    bool hasValue(TemplateKey key) const
+    {
+        return (m_flags & (1u << key)) != 0;
+    }
+
+    void clear()
+    {
+        for (int key = 0; key < TK_MAX; ++key)
+        {
+            if (m_flags & (1u << key))
+            {
+                m_values[key].clear();
+            }
+        }
+        m_flags = 0;
+    }
+
+    void clearName()
+    {
+        m_name.clear();
+    }
+};
+
+// The TemplateValues of one row: a message and the forwarded messages in it
+// The items are reused by the next row after clear(), so the steady state doesn't allocate
+class TemplateValuesList
+{
+private:
+    std::vector<TemplateValues> m_items;
+    size_t m_size;
+
+public:
+    using const_iterator = std::vector<TemplateValues>::const_iterator;
+
+public:
+    TemplateValuesList() : m_size(0)
+    {
+    }
+
+    TemplateValues& push(const char* name)
+    {
+        if (m_size == m_items.size())
+        {
+            m_items.emplace_back();
+        }
+        TemplateValues& tv = m_items[m_size++];
+        tv.clear();
+        tv.setName(name);
+        return tv;
+    }
+
+    TemplateValues& back()
+    {
+        return m_items[m_size - 1];
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    bool empty() const
+    {
+        return m_size == 0;
+    }
+
+    void clear()
+    {
+        m_size = 0;
+    }
+
+    const_iterator cbegin() const
+    {
+        return m_items.cbegin();
+    }
+
+    const_iterator cend() const
+    {
+        return m_items.cbegin() + m_size;
+    }
+};
+
+// A template compiled into literal and placeholder segments when it is loaded,
+// so rendering is a single pass which appends the segments to the output
+// Unknown placeholders are dropped at compile time and the placeholders without values render as empty
+class Template
+{
+private:
+    struct Segment
+    {
+        TemplateKey key;                    // TK_MAX for literal text
+        std::string::size_type offset;      // Range of the literal text in m_text
+        std::string::size_type length;
+    };
+    
+    std::string m_text;
+    std::vector<Segment> m_segments;
+    
+public:
+    Template()
+    {
+    }
+    
+    Template(const std::string& text)
+    {
+        compile(text);
+    }
+    
+    void compile(const std::string& text)
+    {
+        m_text = text;
+        m_segments.clear();
+        
+        std::string::size_type literalStart = 0;
+        std::string::size_type pos = 0;
+        while ((pos = m_text.find("%%", pos)) != std::string::npos)
+        {
+            std::string::size_type posEnd = m_text.find("%%", pos + 2);
+            if (posEnd == std::string::npos)
+            {
+                break;
+            }
+            
+            addLiteral(literalStart, pos);
+            TemplateKey key = findTemplateKey(m_text.c_str() + pos, posEnd + 2 - pos);
+            if (key != TK_MAX)
+            {
+                Segment segment = { key, 0, 0 };
+                m_segments.push_back(segment);
+            }
+            pos = posEnd + 2;
+            literalStart = pos;
+        }
+        addLiteral(literalStart, m_text.size());
+    }
+    
+    bool empty() const
+    {
+        return m_text.empty();
+    }
+    
+    void render(const TemplateValues& values, std::string& output) const
+    {
+        render(values, 0, m_segments.size(), output);
+    }
+    
+    size_t getNumberOfSegments() const
+    {
+        return m_segments.size();
+    }
+    
+    // Returns the index of the first segment of the placeholder, or getNumberOfSegments() if it is absent
+    size_t findPlaceholder(TemplateKey key) const
+    {
+        for (size_t index = 0; index < m_segments.size(); ++index)
+        {
+            if (m_segments[index].key == key)
+            {
+                return index;
+            }
+        }
+        return m_segments.size();
+    }
+    
+    // Renders the segments in [first, last), which lets the caller stream the content between them
+    void render(const TemplateValues& values, size_t first, size_t last, std::string& output) const
+    {
+        for (size_t index = first; index < last && index < m_segments.size(); ++index)
+        {
+            const Segment& segment = m_segments[index];
+            if (segment.key == TK_MAX)
+            {
+                output.append(m_text, segment.offset, segment.length);
+            }
+            else if (values.hasValue(segment.key))
+            {
+                output.append(values.getValue(segment.key));
+            }
+        }
+    }
+    
+private:
+    void addLiteral(std::string::size_type start, std::string::size_type end)
+    {
+        if (end > start)
+        {
+            Segment segment = { TK_MAX, start, end - start };
+            m_segments.push_back(segment);
+        }
+    }
+};
+
+#endif /* TemplateValues_h */
@@ -16,6 +16,7 @@
 #include <codecvt>
 #include <locale>
 #include <cstdio>
+#include <mutex>
 #ifdef _WIN32
 #include <direct.h>
 #include <atlstr.h>
@@ -28,11 +29,22 @@
 #include <sys/stat.h>
 #include <time.h>
 #include <sqlite3.h>
-#include <curl/curl.h>
 #include "OSDef.h"
+#include "FileCopier.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#define HTML_ESCAPE_SSE2
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HTML_ESCAPE_NEON
+#endif
 
 
-std::string replaceAll(std::string input, std::string search, std::string replace)
+std::string replaceAll(const std::string& input, const std::string& search, const std::string& replace)
 {
     std::string result = input;
     size_t pos = 0;
@@ -167,28 +179,204 @@ void normalizePath(std::string& path)
 
 std::string safeHTML(const std::string& s)
 {
-    std::string result = replaceAll(s, "&", "&amp;");
-    result = replaceAll(result, " ", "&nbsp;");
-    result = replaceAll(result, "<", "&lt;");
-    result = replaceAll(result, ">", "&gt;");
-    result = replaceAll(result, "\r\n", "<br/>");
-    result = replaceAll(result, "\r", "<br/>");
-    result = replaceAll(result, "\n", "<br/>");
+    std::string result;
+    appendSafeHTML(s, result);
     return result;
 }
 
+static inline bool isHtmlSpecialChar(char ch)
+{
+    return ch == '&' || ch == ' ' || ch == '<' || ch == '>' || ch == '\r' || ch == '\n';
+}
+
+// Returns the position of the first char in [pos, length) which needs escaping, or length if there is none
+// 16 bytes are checked at a time with SSE2/NEON, the tail is checked byte by byte
+static inline size_t findHtmlSpecialChar(const char* data, size_t pos, size_t length)
+{
+#if defined(HTML_ESCAPE_SSE2)
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    for (; pos + 16 <= length; pos += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        __m128i matched = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, amp), _mm_cmpeq_epi8(chunk, space)),
+                                       _mm_or_si128(_mm_cmpeq_epi8(chunk, lt), _mm_cmpeq_epi8(chunk, gt)));
+        matched = _mm_or_si128(matched, _mm_or_si128(_mm_cmpeq_epi8(chunk, cr), _mm_cmpeq_epi8(chunk, lf)));
+        int mask = _mm_movemask_epi8(matched);
+        if (mask != 0)
+        {
+#ifdef _MSC_VER
+            unsigned long index = 0;
+            _BitScanForward(&index, static_cast<unsigned long>(mask));
+            return pos + index;
+#else
+            return pos + __builtin_ctz(static_cast<unsigned int>(mask));
+#endif
+        }
+    }
+#elif defined(HTML_ESCAPE_NEON)
+    const uint8x16_t amp = vdupq_n_u8('&');
+    const uint8x16_t space = vdupq_n_u8(' ');
+    const uint8x16_t lt = vdupq_n_u8('<');
+    const uint8x16_t gt = vdupq_n_u8('>');
+    const uint8x16_t cr = vdupq_n_u8('\r');
+    const uint8x16_t lf = vdupq_n_u8('\n');
+    for (; pos + 16 <= length; pos += 16)
+    {
+        uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(data + pos));
+        uint8x16_t matched = vorrq_u8(vorrq_u8(vceqq_u8(chunk, amp), vceqq_u8(chunk, space)),
+                                      vorrq_u8(vceqq_u8(chunk, lt), vceqq_u8(chunk, gt)));
+        matched = vorrq_u8(matched, vorrq_u8(vceqq_u8(chunk, cr), vceqq_u8(chunk, lf)));
+        // Narrow every byte of the mask to 4 bits, which gives a 64-bit mask
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(matched), 4)), 0);
+        if (mask != 0)
+        {
+            return pos + (__builtin_ctzll(mask) >> 2);
+        }
+    }
+#endif
+    for (; pos < length; ++pos)
+    {
+        if (isHtmlSpecialChar(data[pos]))
+        {
+            break;
+        }
+    }
+    return pos;
+}
+
+void appendSafeHTML(const std::string& s, std::string& output)
+{
+    const char* data = s.c_str();
+    const size_t length = s.size();
+    
+    size_t literalStart = 0;
+    size_t pos = 0;
+    while ((pos = findHtmlSpecialChar(data, pos, length)) < length)
+    {
+        output.append(data + literalStart, pos - literalStart);
+        switch (data[pos])
+        {
+            case '&':
+                output.append("&amp;", 5);
+                break;
+            case ' ':
+                output.append("&nbsp;", 6);
+                break;
+            case '<':
+                output.append("&lt;", 4);
+                break;
+            case '>':
+                output.append("&gt;", 4);
+                break;
+            case '\r':
+                if (pos + 1 < length && data[pos + 1] == '\n')
+                {
+                    ++pos;
+                }
+                output.append("<br/>", 5);
+                break;
+            default:    // '\n'
+                output.append("<br/>", 5);
+                break;
+        }
+        ++pos;
+        literalStart = pos;
+    }
+    output.append(data + literalStart, length - literalStart);
+}
+
+void appendJsonString(const std::string& s, std::string& output)
+{
+    static const char hexChars[] = "0123456789abcdef";
+    
+    output.reserve(output.size() + s.size() + 2);
+    output.push_back('"');
+    std::string::size_type literalStart = 0;
+    for (std::string::size_type idx = 0; idx < s.size(); ++idx)
+    {
+        unsigned char ch = static_cast<unsigned char>(s[idx]);
+        const char* escaped = NULL;
+        char unicodeEscaped[7] = { 0 };
+        if (ch == '"')
+        {
+            escaped = "\\\"";
+        }
+        else if (ch == '\\')
+        {
+            escaped = "\\\\";
+        }
+        else if (ch == '/' && idx > 0 && s[idx - 1] == '<')
+        {
+            // </script>
+            escaped = "\\/";
+        }
+        else if (ch == '\n')
+        {
+            escaped = "\\n";
+        }
+        else if (ch == '\r')
+        {
+            escaped = "\\r";
+        }
+        else if (ch == '\t')
+        {
+            escaped = "\\t";
+        }
+        else if (ch < 0x20)
+        {
+            unicodeEscaped[0] = '\\';
+            unicodeEscaped[1] = 'u';
+            unicodeEscaped[2] = '0';
+            unicodeEscaped[3] = '0';
+            unicodeEscaped[4] = hexChars[ch >> 4];
+            unicodeEscaped[5] = hexChars[ch & 0xF];
+            escaped = unicodeEscaped;
+        }
+        else if (ch == 0xE2 && idx + 2 < s.size() && static_cast<unsigned char>(s[idx + 1]) == 0x80 && (static_cast<unsigned char>(s[idx + 2]) == 0xA8 || static_cast<unsigned char>(s[idx + 2]) == 0xA9))
+        {
+            // U+2028 and U+2029 are not allowed in string literals of old javascript engines
+            output.append(s, literalStart, idx - literalStart);
+            output.append(static_cast<unsigned char>(s[idx + 2]) == 0xA8 ? "\\u2028" : "\\u2029");
+            idx += 2;
+            literalStart = idx + 1;
+            continue;
+        }
+        
+        if (escaped != NULL)
+        {
+            output.append(s, literalStart, idx - literalStart);
+            output.append(escaped);
+            literalStart = idx + 1;
+        }
+    }
+    output.append(s, literalStart, s.size() - literalStart);
+    output.push_back('"');
+}
+
 void removeHtmlTags(std::string& html)
 {
-    std::string::size_type startpos = 0;
-    while ((startpos = html.find("<", startpos)) != std::string::npos)
+    // One pass in place: the text between the tags is moved to the front
+    // A '<' without '>' after it is kept with the rest of the text
+    std::string::size_type length = 0;
+    std::string::size_type pos = 0;
+    while (pos < html.size())
     {
-        // auto startpos = html.find("<");
-        auto endpos = html.find(">", startpos + 1);
-        if (endpos != std::string::npos)
+        std::string::size_type startpos = html.find('<', pos);
+        std::string::size_type endpos = (startpos == std::string::npos) ? std::string::npos : html.find('>', startpos + 1);
+        std::string::size_type textEnd = (endpos == std::string::npos) ? html.size() : startpos;
+        if (length != pos)
         {
-            html.erase(startpos, endpos - startpos + 1);
+            std::copy(html.begin() + pos, html.begin() + textEnd, html.begin() + length);
         }
+        length += textEnd - pos;
+        pos = (endpos == std::string::npos) ? html.size() : endpos + 1;
     }
+    html.resize(length);
 }
 
 std::string removeCdata(const std::string& str)
@@ -197,15 +385,109 @@ std::string removeCdata(const std::string& str)
     return str;
 }
 
-std::string fromUnixTime(unsigned int unixtime)
+static inline void toLocalTime(std::time_t time, std::tm& t)
 {
-    std::uint32_t time_date_stamp = unixtime;
-    std::time_t temp = time_date_stamp;
-    std::tm* t = std::localtime(&temp);
-    std::stringstream ss; // or if you're going to print, just input directly into the output stream
-    ss << std::put_time(t, "%Y-%m-%d %I:%M:%S %p");
+    // std::localtime is not thread-safe and messages are parsed on multiple threads
+#ifdef _WIN32
+    localtime_s(&t, &time);
+#else
+    localtime_r(&time, &t);
+#endif
+}
+
+// Local time of [start, end) is the time at start plus the offset, which holds for a whole day
+// unless a timezone transition happens in the day. Then only the current minute is cached
+struct LocalTimeCache
+{
+    std::time_t start;
+    std::time_t end;
+    int year;
+    int month;
+    int day;
+    int secondsOfDay;   // At start
+    
+    LocalTimeCache() : start(0), end(0), year(0), month(0), day(0), secondsOfDay(0)
+    {
+    }
     
-    return ss.str();
+    void update(std::time_t time)
+    {
+        std::tm t = { 0 };
+        toLocalTime(time, t);
+        year = t.tm_year + 1900;
+        month = t.tm_mon + 1;
+        day = t.tm_mday;
+        
+        std::time_t midnight = time - (t.tm_hour * 3600 + t.tm_min * 60 + t.tm_sec);
+        std::tm first = { 0 };
+        std::tm last = { 0 };
+        toLocalTime(midnight, first);
+        toLocalTime(midnight + 86399, last);
+        if (first.tm_mday == t.tm_mday && first.tm_hour == 0 && first.tm_min == 0 && first.tm_sec == 0 &&
+            last.tm_mday == t.tm_mday && last.tm_hour == 23 && last.tm_min == 59 && last.tm_sec == 59)
+        {
+            start = midnight;
+            end = midnight + 86400;
+            secondsOfDay = 0;
+        }
+        else
+        {
+            start = time - t.tm_sec;
+            end = start + 60;
+            secondsOfDay = t.tm_hour * 3600 + t.tm_min * 60;
+        }
+    }
+};
+
+static inline char* formatDigits(char* p, int value, int digits)
+{
+    for (int idx = digits - 1; idx >= 0; --idx)
+    {
+        p[idx] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    }
+    return p + digits;
+}
+
+void fromUnixTime(unsigned int unixtime, std::string& output)
+{
+    static thread_local LocalTimeCache cache;
+    
+    std::time_t time = static_cast<std::time_t>(unixtime);
+    if (time < cache.start || time >= cache.end)
+    {
+        cache.update(time);
+    }
+    
+    // "%Y-%m-%d %I:%M:%S %p"
+    int seconds = cache.secondsOfDay + static_cast<int>(time - cache.start);
+    int hour = seconds / 3600;
+    int hour12 = hour % 12 == 0 ? 12 : hour % 12;
+    
+    char buffer[32];
+    char* p = formatDigits(buffer, cache.year, 4);
+    *p++ = '-';
+    p = formatDigits(p, cache.month, 2);
+    *p++ = '-';
+    p = formatDigits(p, cache.day, 2);
+    *p++ = ' ';
+    p = formatDigits(p, hour12, 2);
+    *p++ = ':';
+    p = formatDigits(p, (seconds / 60) % 60, 2);
+    *p++ = ':';
+    p = formatDigits(p, seconds % 60, 2);
+    *p++ = ' ';
+    *p++ = hour < 12 ? 'A' : 'P';
+    *p++ = 'M';
+    
+    output.assign(buffer, p - buffer);
+}
+
+std::string fromUnixTime(unsigned int unixtime)
+{
+    std::string output;
+    fromUnixTime(unixtime, output);
+    return output;
 }
 
 bool existsFile(const std::string &path)
@@ -403,6 +685,17 @@ bool moveFile(const std::string& src, const std::string& dest, bool overwrite/*
 #endif
 }
 
+bool replaceFile(const std::string& src, const std::string& dest)
+{
+#ifdef _WIN32
+	CA2W pszSrc(src.c_str(), CP_UTF8);
+	CA2W pszDest(dest.c_str(), CP_UTF8);
+	return ::MoveFileExW(pszSrc, pszDest, MOVEFILE_REPLACE_EXISTING) != FALSE;
+#else
+	return 0 == rename(src.c_str(), dest.c_str());
+#endif
+}
+
 bool copyFile(const std::string& src, const std::string& dest)
 {
 #ifdef _WIN32
@@ -412,12 +705,8 @@ bool copyFile(const std::string& src, const std::string& dest)
 	BOOL bErrorFlag = ::CopyFile(pszSrc, pszDest, FALSE);
 	return (TRUE == bErrorFlag);
 #else
-	std::ifstream  ss(src, std::ios::binary);
-	std::ofstream  ds(dest, std::ios::binary);
-
-	ds << ss.rdbuf();
-
-	return true;
+	FileCopier copier;
+	return copier.copyFile(src, dest, 0);
 #endif
 }
 
@@ -550,13 +839,95 @@ void updateFileTime(const std::string& path, time_t mtime)
     utime(p.c_str(), &new_times);
 }
 
+bool getFileSizeAndTime(const std::string& path, uint64_t& size, time_t& mtime)
+{
+#ifdef _WIN32
+    CA2W pszW(path.c_str(), CP_UTF8);
+    struct _stat64 st;
+    if (_wstat64(pszW, &st) != 0)
+    {
+        return false;
+    }
+#else
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+    {
+        return false;
+    }
+#endif
+    size = static_cast<uint64_t>(st.st_size);
+    mtime = st.st_mtime;
+    return true;
+}
+
 bool deleteFile(const std::string& fileName)
 {
     return 0 == std::remove(fileName.c_str());
 }
 
-int openSqlite3ReadOnly(const std::string& path, sqlite3 **ppDb)
+// The default SQLITE_MAX_MMAP_SIZE (0x7fff0000) on 64-bit builds, which bench_sqliteprofile.cpp measures: mapping the whole file
+// costs the full scan nothing and halves the time of the cold lookups by rowid, while a cap of 256 MB doesn't help the lookups
+// Every connection maps the file on its own, the pages are shared in the page cache, only the address space adds up
+SqliteReadProfile::SqliteReadProfile() : maxMmapSize(sizeof(void *) >= 8 ? 0x7fff0000ULL : 256 * 1024 * 1024), cacheSize(-8192), tempStoreInMemory(true), queryOnly(true)
 {
+}
+
+static std::mutex g_sqliteReadProfileMutex;
+static SqliteReadProfile g_sqliteReadProfile;
+
+void setSqliteReadProfile(const SqliteReadProfile& profile)
+{
+    std::lock_guard<std::mutex> lock(g_sqliteReadProfileMutex);
+    g_sqliteReadProfile = profile;
+}
+
+SqliteReadProfile getSqliteReadProfile()
+{
+    std::lock_guard<std::mutex> lock(g_sqliteReadProfileMutex);
+    return g_sqliteReadProfile;
+}
+
+static void applySqliteReadProfile(sqlite3 *db)
+{
+    SqliteReadProfile profile = getSqliteReadProfile();
+
+    // The size of the file as the VFS sees it, which may not open it by its path
+    sqlite3_int64 fileSize = 0;
+    sqlite3_file *file = NULL;
+    if (profile.maxMmapSize > 0 && sqlite3_file_control(db, "main", SQLITE_FCNTL_FILE_POINTER, &file) == SQLITE_OK && NULL != file && NULL != file->pMethods)
+    {
+        file->pMethods->xFileSize(file, &fileSize);
+    }
+    // The file doesn't change, so the whole of it can be mapped and the pages are read without copies
+    uint64_t mmapSize = std::min(static_cast<uint64_t>(fileSize < 0 ? 0 : fileSize), profile.maxMmapSize);
+    std::string sql = "PRAGMA mmap_size=" + std::to_string(mmapSize) + ";";
+    if (profile.cacheSize != 0)
+    {
+        sql += "PRAGMA cache_size=" + std::to_string(profile.cacheSize) + ";";
+    }
+    if (profile.tempStoreInMemory)
+    {
+        sql += "PRAGMA temp_store=MEMORY;";
+    }
+    if (profile.queryOnly)
+    {
+        sql += "PRAGMA query_only=ON;";
+    }
+    sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
+}
+
+int openSqlite3ReadOnly(const std::string& path, sqlite3 **ppDb, const char* vfs/* = NULL*/)
+{
+    if (NULL != vfs)
+    {
+        int rc = sqlite3_open_v2(path.c_str(), ppDb, SQLITE_OPEN_READONLY, vfs);
+        if (rc == SQLITE_OK)
+        {
+            applySqliteReadProfile(*ppDb);
+        }
+        return rc;
+    }
+
     std::string sep(1, DIR_SEP);
     std::string encodedPath;
 #ifdef _WIN32
@@ -583,25 +954,13 @@ int openSqlite3ReadOnly(const std::string& path, sqlite3 **ppDb)
 
     std::vector<std::string> parts = split(encodedPath, sep);
     std::vector<std::string> encodedParts;
-    encodedPath.reserve(parts.size() + 1);
+    encodedParts.reserve(parts.size());
 
-    CURL *curl = curl_easy_init();
-    if (curl)
+    for (std::vector<std::string>::const_iterator it = parts.cbegin(); it != parts.cend(); ++it)
     {
-        for (std::vector<std::string>::const_iterator it = parts.cbegin(); it != parts.cend(); ++it)
-        {
-            char *ptr = curl_easy_escape(curl, it->c_str(), it->size());
-            if (ptr)
-            {
-                encodedParts.push_back(std::string(ptr));
-                curl_free(ptr);
-            }
-        }
-
-        curl_easy_cleanup(curl);
-
-        encodedPath = join(encodedParts, sep.c_str());
+        encodedParts.push_back(encodeUrl(*it));
     }
+    encodedPath = join(encodedParts, sep.c_str());
 
 #ifdef _WIN32
     if (driveLen == 0)
@@ -628,7 +987,12 @@ int openSqlite3ReadOnly(const std::string& path, sqlite3 **ppDb)
     pathWithQuery += "?immutable=1&mode=ro";
     
     // return sqlite3_open_v2(path.c_str(), ppDb, SQLITE_OPEN_READONLY, NULL);
-    return sqlite3_open_v2(pathWithQuery.c_str(), ppDb, SQLITE_OPEN_READONLY | SQLITE_OPEN_URI, NULL);
+    int rc = sqlite3_open_v2(pathWithQuery.c_str(), ppDb, SQLITE_OPEN_READONLY | SQLITE_OPEN_URI, NULL);
+    if (rc == SQLITE_OK)
+    {
+        applySqliteReadProfile(*ppDb);
+    }
+    return rc;
 }
 
 int GetBigEndianInteger(const unsigned char* data, int startIndex/* = 0*/)
@@ -649,20 +1013,24 @@ int GetLittleEndianInteger(const unsigned char* data, int startIndex/* = 0*/)
 
 std::string encodeUrl(const std::string& url)
 {
-    std::string encodedUrl = url;
-    CURL *curl = curl_easy_init();
-    if(curl)
+    // Same as curl_easy_escape: everything but the unreserved characters of RFC 3986 is %XX
+    static const char hexChars[] = "0123456789ABCDEF";
+    std::string encodedUrl;
+    encodedUrl.reserve(url.size() * 3);
+    for (std::string::const_iterator it = url.cbegin(); it != url.cend(); ++it)
     {
-        char *output = curl_easy_escape(curl, url.c_str(), static_cast<int>(url.size()));
-        if(output)
+        unsigned char ch = static_cast<unsigned char>(*it);
+        if ((ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9') || ch == '-' || ch == '.' || ch == '_' || ch == '~')
         {
-            encodedUrl = output;
-            curl_free(output);
+            encodedUrl.push_back(static_cast<char>(ch));
+        }
+        else
+        {
+            encodedUrl.push_back('%');
+            encodedUrl.push_back(hexChars[ch >> 4]);
+            encodedUrl.push_back(hexChars[ch & 0x0F]);
         }
-        
-        curl_easy_cleanup(curl);
     }
-    
     return encodedUrl;
 }
 
@@ -11,6 +11,7 @@
 #include <map>
 #include <thread>
 #include <locale>
+#include <cstdint>
 
 #ifdef _WIN32
 #include <io.h>
@@ -22,7 +23,7 @@ typedef int mode_t;
 #ifndef Utils_h
 #define Utils_h
 
-std::string replaceAll(std::string input, std::string search, std::string format);
+std::string replaceAll(const std::string& input, const std::string& search, const std::string& format);
 
 bool endsWith(const std::string& str, const std::string& suffix);
 bool endsWith(const std::string& str, std::string::value_type ch);
@@ -53,13 +54,21 @@ void normalizePath(std::string& path);
 // int makePath(const std::string& path, mode_t mode);
 
 std::string md5(const std::string& s);
+// Hashes many short strings at once, 4 in parallel with SSE2
+void md5(const std::vector<std::string>& inputs, std::vector<std::string>& outputs);
 
 std::string safeHTML(const std::string& s);
+// Same as safeHTML, but appends to output so the caller can reuse the buffer
+void appendSafeHTML(const std::string& s, std::string& output);
 void removeHtmlTags(std::string& html);
+// Appends s as a quoted json string which is also safe to be embedded in <script>
+void appendJsonString(const std::string& s, std::string& output);
 
 std::string removeCdata(const std::string& str);
 
 std::string fromUnixTime(unsigned int unixtime);
+// Thread-safe, the local time is cached per thread and per day
+void fromUnixTime(unsigned int unixtime, std::string& output);
 
 const char* calcVarint32Ptr(const char* p, const char* limit, uint32_t* value);
 const unsigned char* calcVarint32Ptr(const unsigned char* p, const unsigned char* limit, uint32_t* value);
@@ -71,6 +80,8 @@ bool writeFile(const std::string& path, const std::string& data);
 bool writeFile(const std::string& path, const unsigned char* data, unsigned int dataLength);
 bool appendFile(const std::string& path, const unsigned char* data, unsigned int dataLength);
 bool moveFile(const std::string& src, const std::string& dest, bool overwrite = true);
+// Replaces dest in one step, so there is always either the old file or the new one
+bool replaceFile(const std::string& src, const std::string& dest);
 bool copyFile(const std::string& src, const std::string& dest);
 std::string removeInvalidCharsForFileName(const std::string& fileName);
 bool isValidFileName(const std::string& fileName);
@@ -80,13 +91,28 @@ std::string utf8ToLocalAnsi(std::string utf8Str);
 #define utf8ToLocalAnsi(utf8Str) utf8Str
 #endif
 void updateFileTime(const std::string& path, time_t mtime);
+bool getFileSizeAndTime(const std::string& path, uint64_t& size, time_t& mtime);
 bool deleteFile(const std::string& fileName);
 
 int GetBigEndianInteger(const unsigned char* data, int startIndex = 0);
 int GetLittleEndianInteger(const unsigned char* data, int startIndex = 0);
 
 class sqlite3;
-int openSqlite3ReadOnly(const std::string& path, sqlite3 **ppDb);
+// Pragmas of the connections which openSqlite3ReadOnly opens, the databases of the backup are immutable
+struct SqliteReadProfile
+{
+    uint64_t maxMmapSize;       // mmap_size is the size of the file up to it (and SQLITE_MAX_MMAP_SIZE), 0 to read through the page cache
+    int cacheSize;              // cache_size: pages if positive, KiB if negative, 0 to keep the default
+    bool tempStoreInMemory;     // temp_store=MEMORY, for the sorts and DISTINCTs which can't use an index
+    bool queryOnly;             // query_only=ON
+
+    SqliteReadProfile();
+};
+// Process-wide, set it before the databases are opened
+void setSqliteReadProfile(const SqliteReadProfile& profile);
+SqliteReadProfile getSqliteReadProfile();
+// vfs: the name of a VFS (e.g.: BackupVfs) which opens the path as it is, NULL to open it by an immutable file: URI
+int openSqlite3ReadOnly(const std::string& path, sqlite3 **ppDb, const char* vfs = NULL);
 
 std::string encodeUrl(const std::string& url);
 
@@ -7,64 +7,201 @@
 //
 
 #include <string>
-#include <sstream>
-#include <iomanip>
-
-#if defined(_WIN32)
-#include <windows.h>
-#include <wincrypt.h>
-#elif defined(__APPLE__)
-#import <CommonCrypto/CommonDigest.h>
-#else
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include "md5.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MD5_MULTI_BUFFER_SSE2
 #endif
 
 #define MD5_DIGEST_LENGTH 16
+#define MD5_BLOCK_LENGTH 64
+// Longest input which fits in one block with the padding and the length
+#define MD5_MAX_SINGLE_BLOCK_LENGTH 55
+
+static inline void digestToHex(const unsigned char digest[MD5_DIGEST_LENGTH], std::string& output)
+{
+    static const char hexChars[] = "0123456789abcdef";
+
+    char hex[MD5_DIGEST_LENGTH * 2];
+    for (int idx = 0; idx < MD5_DIGEST_LENGTH; idx++)
+    {
+        hex[idx * 2] = hexChars[digest[idx] >> 4];
+        hex[idx * 2 + 1] = hexChars[digest[idx] & 0xF];
+    }
+    output.assign(hex, MD5_DIGEST_LENGTH * 2);
+}
+
+static void md5(const std::string& s, std::string& output)
+{
+    unsigned char digest[MD5_DIGEST_LENGTH] = {0};
+    MD5_CTX ctx;
+    MD5Init(&ctx);
+    MD5Update(&ctx, reinterpret_cast<const unsigned char *>(s.c_str()), static_cast<unsigned>(s.size()));
+    MD5Final(digest, &ctx);
+
+    digestToHex(digest, output);
+}
 
 std::string md5(const std::string& s)
 {
-    std::stringstream stream;
-    stream << std::setfill ('0') << std::hex;
-    
-#if defined(_WIN32)
-    
-    HCRYPTPROV hCryptProv = NULL;
-    HCRYPTHASH hHash = NULL;
-    BYTE bHash[0x7f] = {0};
-    DWORD dwHashLen= MD5_DIGEST_LENGTH; // The MD5 algorithm always returns 16 bytes.
-
-    if(CryptAcquireContext(&hCryptProv, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT | CRYPT_MACHINE_KEYSET))
+    std::string output;
+    md5(s, output);
+    return output;
+}
+
+#ifdef MD5_MULTI_BUFFER_SSE2
+
+// MD5 of 4 short inputs at a time, one input in each 32-bit lane
+// Only for inputs which fit in a single block, e.g.: user names and chatroom ids
+
+static const uint32_t MD5_K[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const int MD5_SHIFTS[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+static inline __m128i rotateLeft(__m128i x, int bits)
+{
+    return _mm_or_si128(_mm_sll_epi32(x, _mm_cvtsi32_si128(bits)), _mm_srl_epi32(x, _mm_cvtsi32_si128(32 - bits)));
+}
+
+static inline uint32_t readLittleEndian32(const unsigned char* p)
+{
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static void md5x4(const std::string* inputs[4], std::string* outputs[4])
+{
+    // Pad every input to a single block and transpose the blocks into lanes
+    unsigned char blocks[4][MD5_BLOCK_LENGTH];
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        const std::string& input = *inputs[lane];
+        unsigned char* block = blocks[lane];
+        memset(block, 0, MD5_BLOCK_LENGTH);
+        memcpy(block, input.c_str(), input.size());
+        block[input.size()] = 0x80;
+        uint32_t bits = static_cast<uint32_t>(input.size()) << 3;
+        block[56] = static_cast<unsigned char>(bits);
+        block[57] = static_cast<unsigned char>(bits >> 8);
+    }
+    __m128i words[16];
+    for (int idx = 0; idx < 16; ++idx)
+    {
+        words[idx] = _mm_set_epi32(static_cast<int>(readLittleEndian32(blocks[3] + idx * 4)), static_cast<int>(readLittleEndian32(blocks[2] + idx * 4)),
+                                   static_cast<int>(readLittleEndian32(blocks[1] + idx * 4)), static_cast<int>(readLittleEndian32(blocks[0] + idx * 4)));
+    }
+
+    const __m128i a0 = _mm_set1_epi32(0x67452301);
+    const __m128i b0 = _mm_set1_epi32(static_cast<int>(0xefcdab89));
+    const __m128i c0 = _mm_set1_epi32(static_cast<int>(0x98badcfe));
+    const __m128i d0 = _mm_set1_epi32(0x10325476);
+    const __m128i ones = _mm_set1_epi32(-1);
+    __m128i a = a0, b = b0, c = c0, d = d0;
+    for (int step = 0; step < 64; ++step)
     {
-        if(CryptCreateHash(hCryptProv, CALG_MD5, 0, 0, &hHash))
+        __m128i f;
+        int g;
+        if (step < 16)
+        {
+            f = _mm_or_si128(_mm_and_si128(b, c), _mm_andnot_si128(b, d));
+            g = step;
+        }
+        else if (step < 32)
+        {
+            f = _mm_or_si128(_mm_and_si128(b, d), _mm_andnot_si128(d, c));
+            g = (5 * step + 1) & 15;
+        }
+        else if (step < 48)
+        {
+            f = _mm_xor_si128(_mm_xor_si128(b, c), d);
+            g = (3 * step + 5) & 15;
+        }
+        else
         {
-            if(CryptHashData(hHash, reinterpret_cast<const BYTE*>(s.c_str()), static_cast<DWORD>(s.size()), 0))
-            {
-                if(CryptGetHashParam(hHash, HP_HASHVAL, bHash, &dwHashLen, 0))
-                {
-                    // Make a string version of the numeric digest value
-                    for (int idx = 0; idx < 16; idx++)
-                    {
-                        stream << std::setw(2) << ((unsigned int) bHash[idx]);
-                    }
-                }
-            }
+            f = _mm_xor_si128(c, _mm_or_si128(b, _mm_xor_si128(d, ones)));
+            g = (7 * step) & 15;
         }
+        f = _mm_add_epi32(_mm_add_epi32(f, a), _mm_add_epi32(_mm_set1_epi32(static_cast<int>(MD5_K[step])), words[g]));
+        a = d;
+        d = c;
+        c = b;
+        b = _mm_add_epi32(b, rotateLeft(f, MD5_SHIFTS[step]));
     }
+    a = _mm_add_epi32(a, a0);
+    b = _mm_add_epi32(b, b0);
+    c = _mm_add_epi32(c, c0);
+    d = _mm_add_epi32(d, d0);
 
-    CryptDestroyHash(hHash);
-    CryptReleaseContext(hCryptProv, 0);
+    uint32_t state[4][4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state[0]), a);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state[1]), b);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state[2]), c);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state[3]), d);
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        unsigned char digest[MD5_DIGEST_LENGTH];
+        for (int word = 0; word < 4; ++word)
+        {
+            uint32_t value = state[word][lane];
+            digest[word * 4] = static_cast<unsigned char>(value);
+            digest[word * 4 + 1] = static_cast<unsigned char>(value >> 8);
+            digest[word * 4 + 2] = static_cast<unsigned char>(value >> 16);
+            digest[word * 4 + 3] = static_cast<unsigned char>(value >> 24);
+        }
+        digestToHex(digest, *outputs[lane]);
+    }
+}
 
-#elif defined(__APPLE__)
-    unsigned char digest[MD5_DIGEST_LENGTH] = {0};
-    CC_MD5(s.c_str(), (CC_LONG)s.size(), digest); // This is the md5 call
+#endif // MD5_MULTI_BUFFER_SSE2
 
-    for (int idx = 0; idx < MD5_DIGEST_LENGTH; idx++)
+void md5(const std::vector<std::string>& inputs, std::vector<std::string>& outputs)
+{
+    outputs.resize(inputs.size());
+    size_t idx = 0;
+#ifdef MD5_MULTI_BUFFER_SSE2
+    const std::string* batchInputs[4];
+    std::string* batchOutputs[4];
+    int batchSize = 0;
+    for (; idx < inputs.size(); ++idx)
     {
-        stream << std::setw(2) << ((unsigned int) digest[idx]);
+        if (inputs[idx].size() > MD5_MAX_SINGLE_BLOCK_LENGTH)
+        {
+            md5(inputs[idx], outputs[idx]);
+            continue;
+        }
+        batchInputs[batchSize] = &inputs[idx];
+        batchOutputs[batchSize] = &outputs[idx];
+        if (++batchSize == 4)
+        {
+            md5x4(batchInputs, batchOutputs);
+            batchSize = 0;
+        }
+    }
+    for (int batchIdx = 0; batchIdx < batchSize; ++batchIdx)
+    {
+        md5(*batchInputs[batchIdx], *batchOutputs[batchIdx]);
     }
 #else
-#error "Md5 Not implemented."
+    for (; idx < inputs.size(); ++idx)
+    {
+        md5(inputs[idx], outputs[idx]);
+    }
 #endif
-
-    return stream.str();
 }
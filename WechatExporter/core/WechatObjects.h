@@ -10,6 +10,7 @@
 #include <vector>
 #include <regex>
 #include <map>
+#include <set>
 #include <algorithm>
 #include <cmath>
 #include "Utils.h"
@@ -584,5 +585,23 @@ struct SessionLastMsgTimeCompare
     }
 };
 
+// Messages to export, compiled into the WHERE clause of the query on Chat_, so the rows which don't match are never read
+struct MessageFilter
+{
+    int startTime;                      // CreateTime >= startTime, 0 for no limit
+    int endTime;                        // CreateTime < endTime, 0 for no limit
+    std::set<int> types;                // Only these types, empty for all
+    std::set<int> excludedTypes;        // Never fetched, unlike SPO_IGNORE_*, which still writes a placeholder for the message
+    std::set<std::string> senders;      // UsrNames, including the account itself, empty for all
+
+    MessageFilter() : startTime(0), endTime(0)
+    {
+    }
+
+    bool isEmpty() const
+    {
+        return startTime == 0 && endTime == 0 && types.empty() && excludedTypes.empty() && senders.empty();
+    }
+};
 
 #endif /* WechatObjects_h */
@@ -25,6 +25,9 @@
 #include "RawMessage.h"
 #include "XmlParser.h"
 #include "MMKVReader.h"
+#include "BlockingQueue.h"
+#include "MessageReader.h"
+#include "SqliteConnectionPool.h"
 
 #include "OSDef.h"
 
@@ -40,6 +43,9 @@ bool parseMembers(const std::string& xml, T& f)
     xmlXPathContextPtr xpathCtx = NULL;
     xmlXPathObjectPtr xpathObj = NULL;
     xmlNodeSetPtr xpathNodes = NULL;
+    std::vector<std::string> uids;
+    std::vector<std::string> displayNames;
+    std::vector<std::string> uidHashes;
 
     doc = xmlParseMemory(xml.c_str(), static_cast<int>(xml.size()));
     if (doc == NULL) { goto end; }
@@ -83,8 +89,15 @@ bool parseMembers(const std::string& xml, T& f)
                 cur = cur->next;
             }
         
-            std::string uidHash = md5(uid);
-            f.addMember(uidHash, std::make_pair(uid, displayName));
+            uids.push_back(uid);
+            displayNames.push_back(displayName);
+        }
+        
+        // Chatrooms may have hundreds of members, hash them in batch
+        md5(uids, uidHashes);
+        for (size_t idx = 0; idx < uids.size(); ++idx)
+        {
+            f.addMember(uidHashes[idx], std::make_pair(uids[idx], displayNames[idx]));
         }
     }
     
@@ -763,14 +776,14 @@ bool SessionsParser::parse(const Friend& user, std::vector<Session>& sessions, c
 {
     std::string usrNameHash = user.getHash();
     std::string userRoot = "Documents/" + usrNameHash;
-    std::string sessionDbPath = m_iTunesDb->findRealPath(combinePath(userRoot, "session", "session.db"));
-	if (sessionDbPath.empty())
+    std::string sessionDbPath = combinePath(userRoot, "session", "session.db");
+	if (NULL == m_iTunesDb->findITunesFile(sessionDbPath))
 	{
 		return false;
 	}
 
     sqlite3 *db = NULL;
-    int rc = openSqlite3ReadOnly(sessionDbPath, &db);
+    int rc = m_iTunesDb->openDatabase(sessionDbPath, &db);
     if (rc != SQLITE_OK)
     {
         sqlite3_close(db);
@@ -880,7 +893,7 @@ bool SessionsParser::parseMessageDbs(const std::string& userRoot, std::vector<Se
 bool SessionsParser::parseMessageDb(const std::string& mmPath, std::vector<std::pair<std::string, int>>& sessionIds)
 {
     sqlite3 *db = NULL;
-    int rc = openSqlite3ReadOnly(mmPath, &db);
+    int rc = m_iTunesDb->openDatabase(mmPath, &db);
     if (rc != SQLITE_OK)
     {
         sqlite3_close(db);
@@ -1147,78 +1160,650 @@ bool SessionsParser::parseSessionsInGroupApp(const std::string& userRoot, std::v
     return true;
 }
 
-SessionParser::SessionParser(Friend& myself, Friends& friends, const ITunesDb& iTunesDb, const Shell& shell, int options, Downloader& downloader, std::function<std::string(const std::string&)> localeFunc) : m_options(options), m_myself(myself), m_friends(friends), m_iTunesDb(iTunesDb), m_shell(shell), m_downloader(downloader)
+SessionParser::SessionParser(Friend& myself, Friends& friends, const ITunesDb& iTunesDb, const Shell& shell, int options, Downloader& downloader, std::function<std::string(const std::string&)> localeFunc) : m_options(options), m_myself(myself), m_friends(friends), m_iTunesDb(iTunesDb), m_shell(shell), m_downloader(downloader), m_outputTree(shell), m_assetStore(m_outputTree, m_fileCopier)
 {
     m_localFunction = std::move(localeFunc);
+    m_fileCopier.setLinkingFiles((m_options & SPO_LINK_FILES) == SPO_LINK_FILES);
+    m_fileCopier.setOutputTree(&m_outputTree);
+    m_fileCopier.setSkippingUnchanged((m_options & SPO_OVERWRITE_FILES) == 0);
+    m_connectionPool.setVfs(m_iTunesDb.getVfsName());
+    m_numberOfWorkers = std::thread::hardware_concurrency();
+    if (m_numberOfWorkers == 0)
+    {
+        m_numberOfWorkers = 1;
+    }
 }
 
-int SessionParser::parse(const std::string& userBase, const std::string& outputBase, const Session& session, std::function<bool(const std::vector<TemplateValues>&)> handler)
+int SessionParser::parse(const std::string& userBase, const std::string& outputBase, const Session& session, const SessionWatermark& since, SessionWatermark& last, const SessionRowSink& sink)
 {
     int count = 0;
-    sqlite3 *db = NULL;
-    int rc = openSqlite3ReadOnly(session.getDbFile(), &db);
-    if (rc != SQLITE_OK)
     {
-        sqlite3_close(db);
+        std::lock_guard<std::mutex> lock(m_avatarsMtx);
+        m_avatars.clear();
+    }
+    if ((m_options & SPO_SHARED_ASSETS) == SPO_SHARED_ASSETS)
+    {
+        m_assetStore.setStorePath(combinePath(outputBase, "Assets"));
+    }
+    
+    // Sessions share their message_N.sqlite, whose connection is reused with its schema and statements
+    SqliteConnectionPool::ConnectionPtr connection = m_connectionPool.acquire(session.getDbFile());
+    if (!connection)
+    {
         return false;
     }
     
-    std::string sql = "SELECT CreateTime,Message,Des,Type,MesLocalID FROM Chat_" + session.getHash() + " ORDER BY CreateTime";
-    if ((m_options & SPO_DESC) == SPO_DESC)
+    std::vector<std::string> conditions;
+    std::vector<std::string> senderPrefixes;
+    if (since.msgId > 0)
     {
-        sql += " DESC";
+        // MesLocalID grows with new messages
+        conditions.push_back("MesLocalID>?");
     }
+    buildFilterConditions(session, conditions, senderPrefixes);
     
-    sqlite3_stmt* stmt = NULL;
-    rc = sqlite3_prepare_v2(db, sql.c_str(), (int)(sql.size()), &stmt, NULL);
-    if (rc != SQLITE_OK)
+    // The filter is applied to every query of the reader, so the parameters are bound by the binder
+    MessageReader::ParameterBinder binder = [&since, &senderPrefixes](sqlite3_stmt* stmt) {
+        int paramIndex = 1;
+        if (since.msgId > 0)
+        {
+            sqlite3_bind_int(stmt, paramIndex++, since.msgId);
+        }
+        for (std::vector<std::string>::const_iterator it = senderPrefixes.cbegin(); it != senderPrefixes.cend(); ++it)
+        {
+            sqlite3_bind_blob(stmt, paramIndex++, it->c_str(), static_cast<int>(it->size()), SQLITE_TRANSIENT);
+        }
+    };
+    
+    MessageReader reader(*connection, "Chat_" + session.getHash(), (m_options & SPO_DESC) == SPO_DESC);
+    reader.setStatistics(&m_readerStatistics);
+    if (!reader.open(join(conditions, " AND "), binder))
     {
-        sqlite3_close(db);
         return false;
     }
+    last = since;
+
+    // Small chats are not worth the threads
+    const int MIN_ROWS_FOR_PIPELINE = 256;
+    std::vector<std::pair<int64_t, int64_t>> ranges;
+    bool parsedInRanges = false;
+    bool complete = true;
+    if (reader.getPath() == MRP_ROWID && splitIntoRanges(*connection, "Chat_" + session.getHash(), conditions, binder, ranges))
+    {
+        // -1 if the spools can't get temporary files, the reader parses the session in one go then
+        int rangeCount = parseRanges(ranges, conditions, binder, userBase, outputBase, session, last, sink, complete);
+        if (rangeCount >= 0)
+        {
+            // Counted as the ranges which are read
+            reader.setStatistics(NULL);
+            count = rangeCount;
+            parsedInRanges = true;
+        }
+    }
+    
+    if (!parsedInRanges)
+    {
+        if (m_numberOfWorkers > 1 && (session.getRecordCount() == 0 || session.getRecordCount() >= MIN_ROWS_FOR_PIPELINE))
+        {
+            count = parseWithPipeline(reader, userBase, outputBase, session, last, sink);
+        }
+        else
+        {
+            TemplateValuesList tvs;
+            MsgRecord record;
+            RowParsingContext context;
+            std::string content;
+
+            while (reader.next(record))
+            {
+                tvs.clear();
+            
+                if (record.msgId > last.msgId)
+                {
+                    last.msgId = record.msgId;
+                    last.createTime = record.createTime;
+                }
+                if (parseRow(record, context, userBase, outputBase, session, tvs))
+                {
+                    count++;
+                    content.clear();
+                    sink.render(tvs, content);
+                    if (sink.write(content))
+                    {
+                        // cancelled
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    
+    reader.close();
+    // The pages refer to the mp3 files already
+    m_audioTranscoder.waitForCompletion();
+    
+    return complete ? count : -1;
+}
 
-    std::vector<TemplateValues> tvs;
+struct PipelineRow
+{
+    size_t seq;     // Position in the result set of the query, the render stage restores this order
+    bool parsed;
     MsgRecord record;
+    TemplateValuesList tvs;
+    std::string content;
+};
 
-    while (sqlite3_step(stmt) == SQLITE_ROW)
+// Rows flow through three stages:
+//   reader (one thread):   reads the rows in the order of CreateTime and tags each row with its sequence number
+//   decoders (N threads):  parseRow, including xml parsing, file copying and submitting audio to the transcoder, and rendering
+//   writer (this thread):  restores the order of the rows and hands the rendered rows to the sink
+// The number of rows in flight is bounded, so memory doesn't grow with the size of the chat
+int SessionParser::parseWithPipeline(MessageReader& messageReader, const std::string& userBase, const std::string& outputBase, const Session& session, SessionWatermark& last, const SessionRowSink& sink)
+{
+    const size_t MAX_ROWS_IN_FLIGHT = 64 * m_numberOfWorkers;
+    
+    // libxml2 must be initialized before it is used from multiple threads
+    xmlInitParser();
+    
+    // The rows are allocated once and recycled: the writer stage gives a row back to the reader
+    // after the sink is done with it, so the strings in MsgRecord, TemplateValues and the content keep their capacity
+    std::vector<PipelineRow> rows(MAX_ROWS_IN_FLIGHT);
+    BlockingQueue<PipelineRow *> freeRows(MAX_ROWS_IN_FLIGHT);
+    for (std::vector<PipelineRow>::iterator it = rows.begin(); it != rows.end(); ++it)
     {
-        tvs.clear();
+        freeRows.push(&(*it));
+    }
+    BlockingQueue<PipelineRow *> rowQueue(4 * m_numberOfWorkers);
+    BlockingQueue<PipelineRow *> parsedQueue(MAX_ROWS_IN_FLIGHT);
+    std::atomic_bool stopped(false);
+    std::atomic_uint runningWorkers(m_numberOfWorkers);
+    
+    std::thread reader([&]() {
+        size_t seq = 0;
+        PipelineRow* row = NULL;
+        while (!stopped && freeRows.pop(row))
+        {
+            if (stopped || !messageReader.next(row->record))
+            {
+                break;
+            }
+            
+            row->seq = seq++;
+            row->parsed = false;
+            if (!rowQueue.push(std::move(row)))
+            {
+                break;
+            }
+        }
+        rowQueue.close();
+    });
+    
+    std::vector<std::thread> workers;
+    for (unsigned int idx = 0; idx < m_numberOfWorkers; ++idx)
+    {
+        workers.emplace_back([&]() {
+            RowParsingContext context;
+            PipelineRow* row = NULL;
+            while (rowQueue.pop(row))
+            {
+                if (!stopped)
+                {
+                    row->tvs.clear();
+                    row->parsed = parseRow(row->record, context, userBase, outputBase, session, row->tvs);
+                    if (row->parsed)
+                    {
+                        row->content.clear();
+                        sink.render(row->tvs, row->content);
+                    }
+                }
+                parsedQueue.push(std::move(row));
+            }
+            if (--runningWorkers == 0)
+            {
+                parsedQueue.close();
+            }
+        });
+    }
+    
+    // No more than MAX_ROWS_IN_FLIGHT rows are out of the free list, so the sequence numbers
+    // of the pending rows never collide in the ring
+    int count = 0;
+    size_t nextSeq = 0;
+    std::vector<PipelineRow *> pendingRows(MAX_ROWS_IN_FLIGHT, NULL);
+    PipelineRow* row = NULL;
+    while (parsedQueue.pop(row))
+    {
+        if (stopped)
+        {
+            // Drain the queue so that the reader and workers can exit
+            freeRows.push(std::move(row));
+            continue;
+        }
         
-        record.createTime = sqlite3_column_int(stmt, 0);
-        const unsigned char* pMessage = sqlite3_column_text(stmt, 1);
+        pendingRows[row->seq % MAX_ROWS_IN_FLIGHT] = row;
+        PipelineRow* nextRow = NULL;
+        while ((nextRow = pendingRows[nextSeq % MAX_ROWS_IN_FLIGHT]) != NULL && nextRow->seq == nextSeq)
+        {
+            pendingRows[nextSeq % MAX_ROWS_IN_FLIGHT] = NULL;
+            ++nextSeq;
+            if (!stopped && nextRow->record.msgId > last.msgId)
+            {
+                last.msgId = nextRow->record.msgId;
+                last.createTime = nextRow->record.createTime;
+            }
+            if (!stopped && nextRow->parsed)
+            {
+                count++;
+                if (sink.write(nextRow->content))
+                {
+                    // cancelled
+                    stopped = true;
+                }
+            }
+            freeRows.push(std::move(nextRow));
+        }
+        if (stopped)
+        {
+            for (std::vector<PipelineRow *>::iterator it = pendingRows.begin(); it != pendingRows.end(); ++it)
+            {
+                if (*it != NULL)
+                {
+                    freeRows.push(std::move(*it));
+                    *it = NULL;
+                }
+            }
+        }
+    }
+    
+    freeRows.close();
+    reader.join();
+    for (std::vector<std::thread>::iterator it = workers.begin(); it != workers.end(); ++it)
+    {
+        it->join();
+    }
+    
+    return count;
+}
+
+// Rendered rows of a range, in a temporary file until the ranges before it are written
+// Every entry: msgId, createTime, length of the content (PARSED_NONE if the row isn't parsed), content
+class RangeSpool
+{
+protected:
+    FILE* m_file;               // NULL if there is no temporary file
+    std::string m_buffer;
+
+public:
+    static const uint32_t PARSED_NONE = 0xFFFFFFFF;
+
+    RangeSpool() : m_file(tmpfile())
+    {
+    }
+    RangeSpool(const RangeSpool&) = delete;
+    RangeSpool& operator=(const RangeSpool&) = delete;
+    ~RangeSpool()
+    {
+        if (NULL != m_file)
+        {
+            fclose(m_file);
+        }
+    }
+
+    // The range isn't kept in memory, so a spool without a file can't be used
+    bool isOpen() const
+    {
+        return NULL != m_file;
+    }
+
+    bool append(const MsgRecord& record, bool parsed, const std::string& content)
+    {
+        int32_t header[3] = { record.msgId, record.createTime, static_cast<int32_t>(parsed ? static_cast<uint32_t>(content.size()) : PARSED_NONE) };
+        m_buffer.append(reinterpret_cast<const char *>(header), sizeof(header));
+        if (parsed)
+        {
+            m_buffer.append(content);
+        }
+        return m_buffer.size() < SPOOL_BUFFER_SIZE || flush();
+    }
+
+    // Switches to reading
+    bool rewind()
+    {
+        if (!flush())
+        {
+            return false;
+        }
+        ::rewind(m_file);
+        return true;
+    }
+
+    // False at the end
+    bool read(int& msgId, int& createTime, bool& parsed, std::string& content)
+    {
+        int32_t header[3] = { 0 };
+        if (!readData(reinterpret_cast<char *>(header), sizeof(header)))
+        {
+            return false;
+        }
+        msgId = header[0];
+        createTime = header[1];
+        parsed = static_cast<uint32_t>(header[2]) != PARSED_NONE;
+        content.resize(parsed ? static_cast<uint32_t>(header[2]) : 0);
+        return content.empty() || readData(&content[0], content.size());
+    }
+
+protected:
+    static const size_t SPOOL_BUFFER_SIZE = 1024 * 1024;
+
+    bool flush()
+    {
+        if (!m_buffer.empty())
+        {
+            if (fwrite(m_buffer.c_str(), 1, m_buffer.size(), m_file) != m_buffer.size())
+            {
+                return false;
+            }
+            m_buffer.clear();
+        }
+        return true;
+    }
+
+    bool readData(char* data, size_t length)
+    {
+        return fread(data, 1, length, m_file) == length;
+    }
+};
+
+bool SessionParser::splitIntoRanges(SqliteConnection& connection, const std::string& table, const std::vector<std::string>& conditions, const MessageReader::ParameterBinder& binder, std::vector<std::pair<int64_t, int64_t>>& ranges) const
+{
+    // A range is read on its own thread, with its own connection, so it must be worth a thread
+    const int64_t MIN_ROWS_PER_RANGE = 50000;
+    if (m_numberOfWorkers < 2)
+    {
+        return false;
+    }
+
+    std::string sql = "SELECT min(rowid),max(rowid) FROM " + table;
+    if (!conditions.empty())
+    {
+        sql += " WHERE " + join(conditions, " AND ");
+    }
+    sqlite3_stmt* stmt = connection.prepare(sql);
+    if (NULL == stmt)
+    {
+        return false;
+    }
+    binder(stmt);
+    int64_t minRowId = 0;
+    int64_t maxRowId = -1;
+    if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL)
+    {
+        minRowId = sqlite3_column_int64(stmt, 0);
+        maxRowId = sqlite3_column_int64(stmt, 1);
+    }
+    connection.reset(stmt);
+
+    // MesLocalID is almost dense, so the span of rowids is close to the number of rows
+    int64_t span = maxRowId - minRowId + 1;
+    int64_t numberOfRanges = std::min(static_cast<int64_t>(m_numberOfWorkers), span / MIN_ROWS_PER_RANGE);
+    if (numberOfRanges < 2)
+    {
+        return false;
+    }
+    ranges.clear();
+    for (int64_t idx = 0; idx < numberOfRanges; ++idx)
+    {
+        ranges.push_back(std::make_pair(minRowId + span * idx / numberOfRanges, minRowId + span * (idx + 1) / numberOfRanges));
+    }
+    return true;
+}
+
+// The table is in rowid order, so ranges of rowids are ranges of CreateTime:
+// every range is read, parsed and rendered with its own connection, the first one in the order of output
+// on this thread straight to the sink and each of the others on its own thread into its spool,
+// and the spools are written to the sink in the order of the ranges after the first one
+// The time of the session is bounded by its largest range instead of its size
+// A range whose thread fails (no connection, the query or the spool fails, e.g.: the temporary disk is full)
+// is read again on this thread straight to the sink when its turn comes, so a failure never drops messages
+// -1 before anything is parsed if a spool can't get a temporary file or the first range fails, as a range isn't spooled in memory
+// complete: false if a range can't be read on this thread either, the messages before it are written to the sink
+int SessionParser::parseRanges(const std::vector<std::pair<int64_t, int64_t>>& ranges, const std::vector<std::string>& conditions, const MessageReader::ParameterBinder& binder, const std::string& userBase, const std::string& outputBase, const Session& session, SessionWatermark& last, const SessionRowSink& sink, bool& complete)
+{
+    // libxml2 must be initialized before it is used from multiple threads
+    xmlInitParser();
+    
+    bool descending = (m_options & SPO_DESC) == SPO_DESC;
+    std::atomic_bool stopped(false);    // Cancelled, or the ranges are dropped
+    int count = 0;
+    uint64_t numberOfRows = 0;
+    complete = true;
+    
+    // Written to the sink if spool is NULL
+    // False if the range isn't read completely, which isn't the case when it's cancelled
+    std::function<bool(size_t, RangeSpool*)> parseRange = [&](size_t idx, RangeSpool* spool) {
+        SqliteConnectionPool::ConnectionPtr connection = m_connectionPool.acquire(session.getDbFile());
+        if (!connection)
+        {
+            return false;
+        }
         
-        record.message = pMessage != NULL ? reinterpret_cast<const char*>(pMessage) : "";
-        record.des = sqlite3_column_int(stmt, 2);
-        record.type = sqlite3_column_int(stmt, 3);
-        record.msgId = sqlite3_column_int(stmt, 4);
-        if (parseRow(record, userBase, outputBase, session, tvs))
+        // The bounds are named parameters, so the ranges share their statements in the cache
+        std::vector<std::string> rangeConditions(conditions);
+        rangeConditions.push_back("rowid>=:rangeStart AND rowid<:rangeEnd");
+        MessageReader::ParameterBinder rangeBinder = [&binder, &ranges, idx](sqlite3_stmt* stmt) {
+            binder(stmt);
+            sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":rangeStart"), ranges[idx].first);
+            sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":rangeEnd"), ranges[idx].second);
+        };
+        MessageReader reader(*connection, "Chat_" + session.getHash(), descending);
+        reader.setCheckingOrder(false);
+        if (!reader.open(join(rangeConditions, " AND "), rangeBinder))
         {
-            count++;
-            if (handler(tvs))
+            return false;
+        }
+        
+        bool succeeded = true;
+        TemplateValuesList tvs;
+        MsgRecord record;
+        RowParsingContext context;
+        std::string content;
+        while (!stopped && reader.next(record))
+        {
+            tvs.clear();
+            content.clear();
+            bool parsed = parseRow(record, context, userBase, outputBase, session, tvs);
+            if (parsed)
+            {
+                sink.render(tvs, content);
+            }
+            if (NULL != spool)
             {
-                // cancelled
+                if (!spool->append(record, parsed, content))
+                {
+                    succeeded = false;
+                    break;
+                }
+                continue;
+            }
+            
+            numberOfRows++;
+            if (record.msgId > last.msgId)
+            {
+                last.msgId = record.msgId;
+                last.createTime = record.createTime;
+            }
+            if (parsed)
+            {
+                count++;
+                if (sink.write(content))
+                {
+                    // cancelled
+                    stopped = true;
+                }
+            }
+        }
+        
+        reader.close();
+        return succeeded;
+    };
+    
+    std::vector<RangeSpool> spools(ranges.size());
+    for (size_t seq = 1; seq < ranges.size(); ++seq)
+    {
+        if (!spools[descending ? (ranges.size() - 1 - seq) : seq].isOpen())
+        {
+            // e.g.: the temporary directory is read-only or full, nothing is parsed yet
+            return -1;
+        }
+    }
+    std::vector<std::thread> threads(ranges.size());
+    std::vector<char> spooled(ranges.size(), 0);    // Written by the threads, read after they are joined
+    for (size_t seq = 1; seq < ranges.size(); ++seq)
+    {
+        size_t idx = descending ? (ranges.size() - 1 - seq) : seq;
+        threads[idx] = std::thread([&parseRange, &spools, &spooled, idx]() {
+            spooled[idx] = parseRange(idx, &spools[idx]) ? 1 : 0;
+        });
+    }
+    if (!parseRange(descending ? (ranges.size() - 1) : 0, NULL))
+    {
+        // Nothing is written to the sink yet
+        stopped = true;
+        for (std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); ++it)
+        {
+            if (it->joinable())
+            {
+                it->join();
+            }
+        }
+        return -1;
+    }
+    
+    int msgId = 0;
+    int createTime = 0;
+    bool parsed = false;
+    std::string content;
+    for (size_t seq = 1; seq < ranges.size() && !stopped; ++seq)
+    {
+        size_t idx = descending ? (ranges.size() - 1 - seq) : seq;
+        threads[idx].join();
+        if (stopped)
+        {
+            break;
+        }
+        if (!spooled[idx] || !spools[idx].rewind())
+        {
+            if (!parseRange(idx, NULL))
+            {
+                complete = false;
                 break;
             }
+            continue;
+        }
+        while (spools[idx].read(msgId, createTime, parsed, content))
+        {
+            numberOfRows++;
+            if (msgId > last.msgId)
+            {
+                last.msgId = msgId;
+                last.createTime = createTime;
+            }
+            if (parsed)
+            {
+                count++;
+                if (sink.write(content))
+                {
+                    // cancelled
+                    stopped = true;
+                    break;
+                }
+            }
         }
     }
     
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
+    stopped = true;
+    for (std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); ++it)
+    {
+        if (it->joinable())
+        {
+            it->join();
+        }
+    }
+    m_readerStatistics.add(MRP_RANGES, numberOfRows, 0);
     
     return count;
 }
 
-bool SessionParser::parseRow(MsgRecord& record, const std::string& userBase, const std::string& outputPath, const Session& session, std::vector<TemplateValues>& tvs)
+static std::string joinTypes(const std::set<int>& types)
+{
+    std::string result;
+    for (std::set<int>::const_iterator it = types.cbegin(); it != types.cend(); ++it)
+    {
+        if (!result.empty())
+        {
+            result.push_back(',');
+        }
+        result += std::to_string(*it);
+    }
+    return result;
+}
+
+void SessionParser::buildFilterConditions(const Session& session, std::vector<std::string>& conditions, std::vector<std::string>& senderPrefixes) const
 {
-    TemplateValues& templateValues = *(tvs.emplace(tvs.end(), "msg"));
+    if (m_filter.startTime > 0)
+    {
+        conditions.push_back("CreateTime>=" + std::to_string(m_filter.startTime));
+    }
+    if (m_filter.endTime > 0)
+    {
+        conditions.push_back("CreateTime<" + std::to_string(m_filter.endTime));
+    }
+    if (!m_filter.types.empty())
+    {
+        conditions.push_back("Type IN (" + joinTypes(m_filter.types) + ")");
+    }
+    if (!m_filter.excludedTypes.empty())
+    {
+        conditions.push_back("Type NOT IN (" + joinTypes(m_filter.excludedTypes) + ")");
+    }
+    if (!m_filter.senders.empty())
+    {
+        // Des is 0 for the messages the account sends, the messages of others in a chatroom start with "<usrName>:\n"
+        std::vector<std::string> senderConditions;
+        for (std::set<std::string>::const_iterator it = m_filter.senders.cbegin(); it != m_filter.senders.cend(); ++it)
+        {
+            if (*it == m_myself.getUsrName())
+            {
+                senderConditions.push_back("Des=0");
+            }
+            else if (session.isChatroom())
+            {
+                std::string prefix = *it + ":\n";
+                senderConditions.push_back("(Des<>0 AND substr(CAST(Message AS BLOB),1," + std::to_string(prefix.size()) + ")=?)");
+                senderPrefixes.push_back(prefix);
+            }
+            else if (*it == session.getUsrName())
+            {
+                senderConditions.push_back("Des<>0");
+            }
+        }
+        // None of the senders is in the session
+        conditions.push_back(senderConditions.empty() ? "0" : ("(" + join(senderConditions, " OR ") + ")"));
+    }
+}
+
+bool SessionParser::parseRow(MsgRecord& record, RowParsingContext& context, const std::string& userBase, const std::string& outputPath, const Session& session, TemplateValuesList& tvs)
+{
+    TemplateValues& templateValues = tvs.push("msg");
     
 	std::string msgIdStr = std::to_string(record.msgId);
     std::string assetsDir = combinePath(outputPath, session.getOutputFileName() + "_files");
     
-    templateValues["%%MSGID%%"] = std::to_string(record.msgId);
-	templateValues["%%NAME%%"] = "";
-	templateValues["%%TIME%%"] = fromUnixTime(record.createTime);
-	templateValues["%%MESSAGE%%"] = "";
+    templateValues[TK_MSGID] = msgIdStr;
+	templateValues[TK_NAME] = "";
+	fromUnixTime(record.createTime, templateValues[TK_TIME]);
+	templateValues[TK_MESSAGE] = "";
     
     std::string forwardedMsg;
     std::string forwardedMsgTitle;
@@ -1231,8 +1816,9 @@ bool SessionParser::parseRow(MsgRecord& record, const std::string& userBase, con
             std::string::size_type enter = record.message.find(":\n");
             if (enter != std::string::npos && enter + 2 < record.message.size())
             {
-                senderId = record.message.substr(0, enter);
-                record.message = record.message.substr(enter + 2);
+                // In place: the buffer of the record is reused from row to row, so neither allocates
+                senderId.assign(record.message, 0, enter);
+                record.message.erase(0, enter + 2);
             }
         }
     }
@@ -1243,9 +1829,9 @@ bool SessionParser::parseRow(MsgRecord& record, const std::string& userBase, con
     if (record.type == 10000 || record.type == 10002)
     {
         templateValues.setName("system");
-        std::string sysMsg = record.message;
-        removeHtmlTags(sysMsg);
-        templateValues["%%MESSAGE%%"] = sysMsg;
+        // The message isn't used after it is rendered, so it is handed over instead of copied
+        removeHtmlTags(record.message);
+        templateValues[TK_MESSAGE].swap(record.message);
     }
     else if (record.type == 34)
     {
@@ -1271,24 +1857,25 @@ bool SessionParser::parseRow(MsgRecord& record, const std::string& userBase, con
         if (audioSrc.empty())
         {
             templateValues.setName("msg");
-            templateValues["%%MESSAGE%%"] = voicelen == -1 ? getLocaleString("[Audio]") : formatString(getLocaleString("[Audio %s]"), getDisplayTime(voicelen).c_str());
+            templateValues[TK_MESSAGE] = voicelen == -1 ? getLocaleString("[Audio]") : formatString(getLocaleString("[Audio %s]"), getDisplayTime(voicelen).c_str());
         }
         else
         {
-            m_pcmData.clear();
             std::string mp3Path = combinePath(assetsDir, msgIdStr + ".mp3");
+            time_t audioTime = (audioSrcFile != NULL) ? ITunesDb::parseModifiedTime(audioSrcFile->blob) : 0;
 
-            silkToPcm(audioSrc, m_pcmData);
-            
-            ensureDirectoryExisted(assetsDir);
-            pcmToMp3(m_pcmData, mp3Path);
-            if (audioSrcFile != NULL)
+            // The mp3 gets the time of the audio, so the one of the previous export can be kept
+            uint64_t mp3Size = 0;
+            time_t mp3Time = 0;
+            if (!(m_fileCopier.isSkippingUnchanged() && audioTime != 0 && getFileSizeAndTime(mp3Path, mp3Size, mp3Time) && mp3Size > 0 && mp3Time == audioTime))
             {
-                updateFileTime(mp3Path, ITunesDb::parseModifiedTime(audioSrcFile->blob));
+                ensureDirectoryExisted(assetsDir);
+                // Encoded by the workers of the transcoder while the parsing goes on, the session waits for them at the end
+                m_audioTranscoder.submit(audioSrc, mp3Path, audioTime);
             }
 
             templateValues.setName("audio");
-            templateValues["%%AUDIOPATH%%"] = session.getOutputFileName() + "_files/" + msgIdStr + ".mp3";
+            templateValues[TK_AUDIOPATH] = session.getOutputFileName() + "_files/" + msgIdStr + ".mp3";
         }
     }
     else if (record.type == 47)
@@ -1327,7 +1914,7 @@ bool SessionParser::parseRow(MsgRecord& record, const std::string& userBase, con
             }
             else
             {
-                static int uniqueFileName = 1000000000;
+                static std::atomic_int uniqueFileName(1000000000);
                 localfile = std::to_string(uniqueFileName++);
             }
             
@@ -1336,12 +1923,12 @@ bool SessionParser::parseRow(MsgRecord& record, const std::string& userBase, con
             ensureDirectoryExisted(outputPath);
             m_downloader.addTask(url, combinePath(outputPath, localfile), record.createTime);
             templateValues.setName("emoji");
-            templateValues["%%EMOJIPATH%%"] = localfile;
+            templateValues[TK_EMOJIPATH] = localfile;
         }
         else
         {
             templateValues.setName("msg");
-            templateValues["%%MESSAGE%%"] = getLocaleString("[Emoji]");
+            templateValues[TK_MESSAGE] = getLocaleString("[Emoji]");
         }
     }
     else if (record.type == 62 || record.type == 43)
@@ -1360,7 +1947,7 @@ bool SessionParser::parseRow(MsgRecord& record, const std::string& userBase, con
     else if (record.type == 50)
     {
         templateValues.setName("msg");
-        templateValues["%%MESSAGE%%"] = getLocaleString("[Video/Audio Call]");
+        templateValues[TK_MESSAGE] = getLocaleString("[Video/Audio Call]");
     }
     else if (record.type == 64)
     {
@@ -1370,7 +1957,7 @@ bool SessionParser::parseRow(MsgRecord& record, const std::string& userBase, con
 		Json::Value root;
 		if (reader.parse(record.message, root))
 		{
-			templateValues["%%MESSAGE%%"] = root["msgContent"].asString();
+			templateValues[TK_MESSAGE] = root["msgContent"].asString();
 		}
     }
     else if (record.type == 3)
@@ -1385,11 +1972,11 @@ bool SessionParser::parseRow(MsgRecord& record, const std::string& userBase, con
         XmlParser xmlParser(record.message);
         if (xmlParser.parseAttributesValue("/msg/location", attrs) && !attrs["x"].empty() && !attrs["y"].empty() && !attrs["label"].empty())
         {
-            templateValues["%%MESSAGE%%"] = formatString(getLocaleString("[Location (%s,%s) %s]"), attrs["x"].c_str(), attrs["y"].c_str(), attrs["label"].c_str());
+            templateValues[TK_MESSAGE] = formatString(getLocaleString("[Location (%s,%s) %s]"), attrs["x"].c_str(), attrs["y"].c_str(), attrs["label"].c_str());
         }
         else
         {
-            templateValues["%%MESSAGE%%"] = getLocaleString("[Location]");
+            templateValues[TK_MESSAGE] = getLocaleString("[Location]");
         }
         templateValues.setName("msg");
     }
@@ -1400,12 +1987,12 @@ bool SessionParser::parseRow(MsgRecord& record, const std::string& userBase, con
         if (xmlParser.parseNodesValue("/msg/appmsg/*", nodes))
         {
             std::string appMsgType = nodes["type"];
-            if (appMsgType == "2001") templateValues["%%MESSAGE%%"] = getLocaleString("[Red Packet]");
-            else if (appMsgType == "2000") templateValues["%%MESSAGE%%"] = getLocaleString("[Transfer]");
-            else if (appMsgType == "17") templateValues["%%MESSAGE%%"] = getLocaleString("[Real-time Location]");
+            if (appMsgType == "2001") templateValues[TK_MESSAGE] = getLocaleString("[Red Packet]");
+            else if (appMsgType == "2000") templateValues[TK_MESSAGE] = getLocaleString("[Transfer]");
+            else if (appMsgType == "17") templateValues[TK_MESSAGE] = getLocaleString("[Real-time Location]");
             else if (appMsgType == "6")
             {
-                // templateValues["%%MESSAGE%%"] = getLocaleString("[File]");
+                // templateValues[TK_MESSAGE] = getLocaleString("[File]");
                 std::string attachFileExtName;
                 xmlParser.parseNodeValue("/msg/appmsg/appattach/fileext", attachFileExtName);
                 std::string attachFileName = userBase + "/OpenData/" + session.getHash() + "/" + msgIdStr;
@@ -1423,7 +2010,7 @@ bool SessionParser::parseRow(MsgRecord& record, const std::string& userBase, con
                 writeFile(combinePath(outputPath, "../dbg", "msg" + std::to_string(record.type) + "_19.txt"), nodes["recorditem"]);
 #endif
                 templateValues.setName("msg");
-                templateValues["%%MESSAGE%%"] = nodes["title"];
+                templateValues[TK_MESSAGE] = nodes["title"];
                 
                 forwardedMsg = nodes["recorditem"];
                 forwardedMsgTitle = nodes["title"];
@@ -1434,24 +2021,24 @@ bool SessionParser::parseRow(MsgRecord& record, const std::string& userBase, con
                 {
                     templateValues.setName(nodes["thumburl"].empty() ? "plainshare" : "share");
 
-                    templateValues["%%SHARINGIMGPATH%%"] = nodes["thumburl"];
-                    templateValues["%%SHARINGURL%%"] = nodes["url"];
-                    templateValues["%%SHARINGTITLE%%"] = nodes["title"];
-                    templateValues["%%MESSAGE%%"] = nodes["des"];
+                    templateValues[TK_SHARINGIMGPATH] = nodes["thumburl"];
+                    templateValues[TK_SHARINGURL] = nodes["url"];
+                    templateValues[TK_SHARINGTITLE] = nodes["title"];
+                    templateValues[TK_MESSAGE] = nodes["des"];
                 }
                 else if (!nodes["title"].empty())
                 {
-                    templateValues["%%MESSAGE%%"] = nodes["title"];
+                    templateValues[TK_MESSAGE] = nodes["title"];
                 }
                 else
                 {
-                    templateValues["%%MESSAGE%%"] = getLocaleString("[Link]");
+                    templateValues[TK_MESSAGE] = getLocaleString("[Link]");
                 }
             }
         }
         else
         {
-            templateValues["%%MESSAGE%%"] = getLocaleString("[Link]");
+            templateValues[TK_MESSAGE] = getLocaleString("[Link]");
         }
     }
     else if (record.type == 42)
@@ -1463,11 +2050,13 @@ bool SessionParser::parseRow(MsgRecord& record, const std::string& userBase, con
     {
         if ((m_options & SPO_IGNORE_HTML_ENC) == 0)
         {
-            templateValues["%%MESSAGE%%"] = safeHTML(record.message);
+            std::string& message = templateValues[TK_MESSAGE];
+            message.clear();
+            appendSafeHTML(record.message, message);
         }
         else
         {
-            templateValues["%%MESSAGE%%"] = record.message;
+            templateValues[TK_MESSAGE].swap(record.message);
         }
     }
     
@@ -1476,36 +2065,32 @@ bool SessionParser::parseRow(MsgRecord& record, const std::string& userBase, con
     
     std::string localPortrait;
     std::string remotePortrait;
+    bool nameEscaped = false;
     if (session.isChatroom())
     {
         if (record.des == 0)
         {
-            templateValues["%%ALIGNMENT%%"] = "right";
-            templateValues["%%NAME%%"] = m_myself.getDisplayName();    // Don't show name for self
+            templateValues[TK_ALIGNMENT] = "right";
+            templateValues[TK_NAME] = m_myself.getDisplayName();    // Don't show name for self
             localPortrait = portraitPath + m_myself.getLocalPortrait();
-            templateValues["%%AVATAR%%"] = localPortrait;
+            templateValues[TK_AVATAR] = localPortrait;
             remotePortrait = m_myself.getPortrait();
         }
         else
         {
-            templateValues["%%ALIGNMENT%%"] = "left";
+            templateValues[TK_ALIGNMENT] = "left";
             if (!senderId.empty())
             {
-                std::string txtsender = session.getMemberName(md5(senderId));
-                const Friend *f = m_friends.getFriendByUid(senderId);
-                if (txtsender.empty() && NULL != f)
-                {
-                    txtsender = f->getDisplayName();
-                }
-                templateValues["%%NAME%%"] = txtsender.empty() ? senderId : txtsender;
-                localPortrait = portraitPath + ((NULL != f) ? f->getLocalPortrait() : "DefaultProfileHead@2x.png");
-                remotePortrait = (NULL != f) ? f->getPortrait() : "";
-                templateValues["%%AVATAR%%"] = localPortrait;
+                // The avatar is queued for downloading when the sender is resolved
+                const SenderInfo& sender = resolveSender(senderId, portraitPath, outputPath, session, record.createTime, context);
+                templateValues[TK_NAME] = sender.name;
+                templateValues[TK_AVATAR] = sender.localPortrait;
+                nameEscaped = true;
             }
             else
             {
-                templateValues["%%NAME%%"] = senderId;
-                templateValues["%%AVATAR%%"] = "";
+                templateValues[TK_NAME] = senderId;
+                templateValues[TK_AVATAR] = "";
             }
         }
     }
@@ -1513,56 +2098,106 @@ bool SessionParser::parseRow(MsgRecord& record, const std::string& userBase, con
     {
         if (record.des == 0 || session.getUsrName() == m_myself.getUsrName())
         {
-            templateValues["%%ALIGNMENT%%"] = "right";
-            templateValues["%%NAME%%"] = m_myself.getDisplayName();
+            templateValues[TK_ALIGNMENT] = "right";
+            templateValues[TK_NAME] = m_myself.getDisplayName();
             localPortrait = portraitPath + m_myself.getLocalPortrait();
             remotePortrait = m_myself.getPortrait();
-            templateValues["%%AVATAR%%"] = localPortrait;
+            templateValues[TK_AVATAR] = localPortrait;
         }
         else
         {
-            templateValues["%%ALIGNMENT%%"] = "left";
+            templateValues[TK_ALIGNMENT] = "left";
 
             const Friend *f = m_friends.getFriend(session.getHash());
             if (NULL == f)
             {
-                templateValues["%%NAME%%"] = session.getDisplayName();
+                templateValues[TK_NAME] = session.getDisplayName();
                 localPortrait = portraitPath + (session.isPortraitEmpty() ? "DefaultProfileHead@2x.png" : session.getLocalPortrait());
                 remotePortrait = session.getPortrait();
-                templateValues["%%AVATAR%%"] = localPortrait;
+                templateValues[TK_AVATAR] = localPortrait;
             }
             else
             {
-                templateValues["%%NAME%%"] = f->getDisplayName();
+                templateValues[TK_NAME] = f->getDisplayName();
                 localPortrait = portraitPath + f->getLocalPortrait();
                 remotePortrait = f->getPortrait();
-                templateValues["%%AVATAR%%"] = localPortrait;
+                templateValues[TK_AVATAR] = localPortrait;
             }
         }
     }
 
-    if ((m_options & SPO_IGNORE_AVATAR) == 0)
-    {
-        if (!remotePortrait.empty() && !localPortrait.empty())
-        {
-            
-            m_downloader.addTask(remotePortrait, combinePath(outputPath, localPortrait), record.createTime);
-        }
-    }
+    registerAvatar(remotePortrait, localPortrait, outputPath, record.createTime, context);
     
-    if ((m_options & SPO_IGNORE_HTML_ENC) == 0)
+    if ((m_options & SPO_IGNORE_HTML_ENC) == 0 && !nameEscaped)
     {
-        templateValues["%%NAME%%"] = safeHTML(templateValues["%%NAME%%"]);
+        context.htmlBuffer.clear();
+        appendSafeHTML(templateValues[TK_NAME], context.htmlBuffer);
+        templateValues[TK_NAME].swap(context.htmlBuffer);
     }
 
     if (!forwardedMsg.empty())
     {
         // This funtion will change tvs and causes templateValues invalid, so we do it at last
-        parseForwardedMsgs(userBase, outputPath, session, record, forwardedMsgTitle, forwardedMsg, tvs);
+        parseForwardedMsgs(userBase, outputPath, session, record, forwardedMsgTitle, forwardedMsg, context, tvs);
     }
     return true;
 }
 
+const SenderInfo& SessionParser::resolveSender(const std::string& senderId, const std::string& portraitPath, const std::string& outputPath, const Session& session, unsigned int createTime, RowParsingContext& context)
+{
+    std::unordered_map<std::string, SenderInfo>::const_iterator it = context.senders.find(senderId);
+    if (it != context.senders.cend())
+    {
+        return it->second;
+    }
+    
+    SenderInfo& sender = context.senders[senderId];
+    std::string txtsender = session.getMemberName(md5(senderId));
+    const Friend *f = m_friends.getFriendByUid(senderId);
+    if (txtsender.empty() && NULL != f)
+    {
+        txtsender = f->getDisplayName();
+    }
+    const std::string& name = txtsender.empty() ? senderId : txtsender;
+    if ((m_options & SPO_IGNORE_HTML_ENC) == 0)
+    {
+        appendSafeHTML(name, sender.name);
+    }
+    else
+    {
+        sender.name = name;
+    }
+    sender.localPortrait = portraitPath + ((NULL != f) ? f->getLocalPortrait() : "DefaultProfileHead@2x.png");
+    sender.remotePortrait = (NULL != f) ? f->getPortrait() : "";
+    
+    registerAvatar(sender.remotePortrait, sender.localPortrait, outputPath, createTime, context);
+    
+    return sender;
+}
+
+// Avatars are passed to the downloader once per participant of the session:
+// each thread remembers what it has registered, so only the first sight of a participant takes the lock
+void SessionParser::registerAvatar(const std::string& remotePortrait, const std::string& localPortrait, const std::string& outputPath, unsigned int createTime, RowParsingContext& context)
+{
+    if ((m_options & SPO_IGNORE_AVATAR) != 0 || remotePortrait.empty() || localPortrait.empty())
+    {
+        return;
+    }
+    if (!context.avatars.insert(localPortrait).second)
+    {
+        return;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(m_avatarsMtx);
+        if (!m_avatars.insert(localPortrait).second)
+        {
+            return;
+        }
+    }
+    m_downloader.addTask(remotePortrait, combinePath(outputPath, localPortrait), createTime);
+}
+
 void SessionParser::parseVideo(const std::string& sessionPath, const std::string& sessionAssertsPath, const std::string& srcVideo, const std::string& destVideo, const std::string& srcThumb, const std::string& destThumb, TemplateValues& templateValues)
 {
     bool hasThumb = false;
@@ -1579,19 +2214,19 @@ void SessionParser::parseVideo(const std::string& sessionPath, const std::string
     if (hasVideo)
     {
         templateValues.setName("video");
-        templateValues["%%THUMBPATH%%"] = hasThumb ? (sessionAssertsPath + "/" + destThumb) : "";
-        templateValues["%%VIDEOPATH%%"] = sessionAssertsPath + "/" + destVideo;
+        templateValues[TK_THUMBPATH] = hasThumb ? (sessionAssertsPath + "/" + destThumb) : "";
+        templateValues[TK_VIDEOPATH] = sessionAssertsPath + "/" + destVideo;
     }
     else if (hasThumb)
     {
         templateValues.setName("thumb");
-        templateValues["%%IMGTHUMBPATH%%"] = sessionAssertsPath + "/" + destThumb;
-        templateValues["%%MESSAGE%%"] = getLocaleString("(Video Missed)");
+        templateValues[TK_IMGTHUMBPATH] = sessionAssertsPath + "/" + destThumb;
+        templateValues[TK_MESSAGE] = getLocaleString("(Video Missed)");
     }
     else
     {
         templateValues.setName("msg");
-        templateValues["%%MESSAGE%%"] = getLocaleString("[Video]");
+        templateValues[TK_MESSAGE] = getLocaleString("[Video]");
     }
 }
 
@@ -1615,19 +2250,19 @@ void SessionParser::parseImage(const std::string& sessionPath, const std::string
     if (hasImage)
     {
         templateValues.setName("image");
-        templateValues["%%IMGPATH%%"] = sessionAssertsPath + "/" + dest;
-        templateValues["%%IMGTHUMBPATH%%"] = hasThumb ? (sessionAssertsPath + "/" + destThumb) : (sessionAssertsPath + "/" + dest);
+        templateValues[TK_IMGPATH] = sessionAssertsPath + "/" + dest;
+        templateValues[TK_IMGTHUMBPATH] = hasThumb ? (sessionAssertsPath + "/" + destThumb) : (sessionAssertsPath + "/" + dest);
     }
     else if (hasThumb)
     {
         templateValues.setName("thumb");
-        templateValues["%%IMGTHUMBPATH%%"] = sessionAssertsPath + "/" + destThumb;
-        templateValues["%%MESSAGE%%"] = "";
+        templateValues[TK_IMGTHUMBPATH] = sessionAssertsPath + "/" + destThumb;
+        templateValues[TK_MESSAGE] = "";
     }
     else
     {
         templateValues.setName("msg");
-        templateValues["%%MESSAGE%%"] = getLocaleString("[Picture]");
+        templateValues[TK_MESSAGE] = getLocaleString("[Picture]");
     }
 }
 
@@ -1642,14 +2277,14 @@ void SessionParser::parseFile(const std::string& sessionPath, const std::string&
     if (hasFile)
     {
         templateValues.setName("plainshare");
-        templateValues["%%SHARINGURL%%"] = sessionAssertsPath + "/" + dest;
-        templateValues["%%SHARINGTITLE%%"] = fileName;
-        templateValues["%%MESSAGE%%"] = "";
+        templateValues[TK_SHARINGURL] = sessionAssertsPath + "/" + dest;
+        templateValues[TK_SHARINGTITLE] = fileName;
+        templateValues[TK_MESSAGE] = "";
     }
     else
     {
         templateValues.setName("msg");
-        templateValues["%%MESSAGE%%"] = formatString(getLocaleString("[File: %s]"), fileName.c_str());
+        templateValues[TK_MESSAGE] = formatString(getLocaleString("[File: %s]"), fileName.c_str());
     }
 }
 
@@ -1671,24 +2306,24 @@ void SessionParser::parseCard(const std::string& sessionPath, const std::string&
     if (xmlParser.parseAttributesValue("/msg", attrs) && !attrs["nickname"].empty())
     {
         templateValues.setName("card");
-        templateValues["%%CARDNAME%%"] = attrs["nickname"];
+        templateValues[TK_CARDNAME] = attrs["nickname"];
         
         std::string portraitUrl = attrs["bigheadimgurl"].empty() ? attrs["smallheadimgurl"] : attrs["bigheadimgurl"];
         if (!attrs["username"].empty() && !portraitUrl.empty())
         {
-            templateValues["%%CARDIMGPATH%%"] = portraitDir + "/" + attrs["username"] + ".jpg";
+            templateValues[TK_CARDIMGPATH] = portraitDir + "/" + attrs["username"] + ".jpg";
             std::string localfile = combinePath(portraitDir, attrs["username"] + ".jpg");
             ensureDirectoryExisted(portraitDir);
             m_downloader.addTask(portraitUrl, combinePath(sessionPath, localfile), 0);
         }
         else
         {
-            templateValues["%%CARDIMGPATH%%"] = portraitUrl;
+            templateValues[TK_CARDIMGPATH] = portraitUrl;
         }
     }
     else
     {
-        templateValues["%%MESSAGE%%"] = getLocaleString("[Contact Card]");
+        templateValues[TK_MESSAGE] = getLocaleString("[Contact Card]");
     }
 }
 
@@ -1711,7 +2346,7 @@ public:
             ForwardMsg fmsg = {m_msgId};
             
             // templateValues.setName("msg");
-            // templateValues["%%ALIGNMENT%%"] = "left";
+            // templateValues[TK_ALIGNMENT] = "left";
             
             xmlNode *cur = xpathNodes->nodeTab[idx];
             
@@ -1785,7 +2420,7 @@ public:
     }
 };
 
-bool SessionParser::parseForwardedMsgs(const std::string& userBase, const std::string& outputPath, const Session& session, const MsgRecord& record, const std::string& title, const std::string& message, std::vector<TemplateValues>& tvs)
+bool SessionParser::parseForwardedMsgs(const std::string& userBase, const std::string& outputPath, const Session& session, const MsgRecord& record, const std::string& title, const std::string& message, RowParsingContext& context, TemplateValuesList& tvs)
 {
     XmlParser xmlParser(message);
     std::vector<ForwardMsg> forwardedMsgs;
@@ -1796,18 +2431,17 @@ bool SessionParser::parseForwardedMsgs(const std::string& userBase, const std::s
     
     std::string msgIdStr = std::to_string(record.msgId);
     
-    tvs.push_back(TemplateValues("notice"));
-    TemplateValues& beginTv = tvs.back();
-    beginTv["%%MESSAGE%%"] = formatString(getLocaleString("<< %s"), title.c_str());
-    beginTv["%%EXTRA_CLS%%"] = "fmsgtag";   // tag for forwarded msg
+    TemplateValues& beginTv = tvs.push("notice");
+    beginTv[TK_MESSAGE] = formatString(getLocaleString("<< %s"), title.c_str());
+    beginTv[TK_EXTRA_CLS] = "fmsgtag";   // tag for forwarded msg
 
     if (xmlParser.parseWithHandler("/recordinfo/datalist/dataitem", handler))
     {
         for (std::vector<ForwardMsg>::const_iterator it = forwardedMsgs.begin(); it != forwardedMsgs.end(); ++it)
         {
-            TemplateValues& tv = *(tvs.emplace(tvs.end(), "msg"));
-            tv["%%ALIGNMENT%%"] = "left";
-            tv["%%EXTRA_CLS%%"] = "fmsg";   // forwarded msg
+            TemplateValues& tv = tvs.push("msg");
+            tv[TK_ALIGNMENT] = "left";
+            tv[TK_EXTRA_CLS] = "fmsg";   // forwarded msg
             // 1: message
             // 2: image
             // 4: video
@@ -1820,7 +2454,7 @@ bool SessionParser::parseForwardedMsgs(const std::string& userBase, const std::s
              
             if (it->dataType == "1")
             {
-                tv["%%MESSAGE%%"] = replaceAll(replaceAll(replaceAll(it->message, "\r\n", "<br />"), "\r", "<br />"), "\n", "<br />");
+                tv[TK_MESSAGE] = replaceAll(replaceAll(replaceAll(it->message, "\r\n", "<br />"), "\r", "<br />"), "\n", "<br />");
             }
             else if (it->dataType == "2")
             {
@@ -1830,7 +2464,7 @@ bool SessionParser::parseForwardedMsgs(const std::string& userBase, const std::s
             }
             else if (it->dataType == "3")
             {
-                tv["%%MESSAGE%%"] = it->message;
+                tv[TK_MESSAGE] = it->message;
             }
             else if (it->dataType == "4")
             {
@@ -1853,14 +2487,14 @@ bool SessionParser::parseForwardedMsgs(const std::string& userBase, const std::s
                 {
                     tv.setName(hasThumb ? "share" : "plainshare");
 
-                    tv["%%SHARINGIMGPATH%%"] = dest;
-                    tv["%%SHARINGURL%%"] = it->link;
-                    tv["%%SHARINGTITLE%%"] = it->message;
-                    // tv["%%MESSAGE%%"] = nodes["des"];
+                    tv[TK_SHARINGIMGPATH] = dest;
+                    tv[TK_SHARINGURL] = it->link;
+                    tv[TK_SHARINGTITLE] = it->message;
+                    // tv[TK_MESSAGE] = nodes["des"];
                 }
                 else
                 {
-                    tv["%%MESSAGE%%"] = it->message;
+                    tv[TK_MESSAGE] = it->message;
                 }
             }
             else if (it->dataType == "6")
@@ -1871,11 +2505,11 @@ bool SessionParser::parseForwardedMsgs(const std::string& userBase, const std::s
                 XmlParser xmlParser(it->nestedMsgs);
                 if (xmlParser.parseNodesValue("/locitem/*", attrs) && !attrs["lat"].empty() && !attrs["lng"].empty() && !attrs["poiname"].empty())
                 {
-                    tv["%%MESSAGE%%"] = formatString(getLocaleString("[Location (%s,%s) %s]"), attrs["lat"].c_str(), attrs["lng"].c_str(), attrs["poiname"].c_str());
+                    tv[TK_MESSAGE] = formatString(getLocaleString("[Location (%s,%s) %s]"), attrs["lat"].c_str(), attrs["lng"].c_str(), attrs["poiname"].c_str());
                 }
                 else
                 {
-                    tv["%%MESSAGE%%"] = getLocaleString("[Location]");
+                    tv[TK_MESSAGE] = getLocaleString("[Location]");
                 }
                 tv.setName("msg");
             }
@@ -1894,54 +2528,54 @@ bool SessionParser::parseForwardedMsgs(const std::string& userBase, const std::s
             else if (it->dataType == "17")
             {
                 // parseForwardedMsgs(userBase, outputPath, session, record, title, it->message, tvs);
-                tv["%%MESSAGE%%"] = it->message;
+                tv[TK_MESSAGE] = it->message;
             }
             else if (it->dataType == "19")
             {
                 // Mini Program
-                tv["%%MESSAGE%%"] = it->message;
+                tv[TK_MESSAGE] = it->message;
             }
             else
             {
-                tv["%%MESSAGE%%"] = it->message;
+                tv[TK_MESSAGE] = it->message;
             }
             
-            tv["%%NAME%%"] = it->displayName;
-            tv["%%MSGID%%"] = msgIdStr + "_" + it->dataId;
-            tv["%%TIME%%"] = it->srcMsgTime.empty() ? it->msgTime : fromUnixTime(static_cast<unsigned int>(std::atoi(it->srcMsgTime.c_str())));
+            tv[TK_NAME] = it->displayName;
+            tv[TK_MSGID] = msgIdStr + "_" + it->dataId;
+            if (it->srcMsgTime.empty())
+            {
+                tv[TK_TIME] = it->msgTime;
+            }
+            else
+            {
+                fromUnixTime(static_cast<unsigned int>(std::atoi(it->srcMsgTime.c_str())), tv[TK_TIME]);
+            }
             
             localPortrait = portraitPath + (it->protrait.empty() ? "DefaultProfileHead@2x.png" : session.getLocalPortrait());
             remotePortrait = it->protrait;
-            tv["%%AVATAR%%"] = localPortrait;
+            tv[TK_AVATAR] = localPortrait;
             if (!it->usrName.empty() && it->protrait.empty())
             {
                 const Friend *f = (m_myself.getUsrName() == it->usrName) ? &m_myself : m_friends.getFriendByUid(it->usrName);
                 std::string localPortrait = portraitPath + ((NULL != f) ? f->getLocalPortrait() : "DefaultProfileHead@2x.png");
                 remotePortrait = (NULL != f) ? f->getPortrait() : "";
                 
-                tv["%%AVATAR%%"] = localPortrait;
+                tv[TK_AVATAR] = localPortrait;
                 
-                if ((m_options & SPO_IGNORE_AVATAR) == 0)
-                {
-                    if (!remotePortrait.empty() && !localPortrait.empty())
-                    {
-                        m_downloader.addTask(remotePortrait, combinePath(outputPath, localPortrait), record.createTime);
-                    }
-                }
+                registerAvatar(remotePortrait, localPortrait, outputPath, record.createTime, context);
             }
             
             if ((it->dataType == "17") && !it->nestedMsgs.empty())
             {
-                parseForwardedMsgs(userBase, outputPath, session, record, it->message, it->nestedMsgs, tvs);
+                parseForwardedMsgs(userBase, outputPath, session, record, it->message, it->nestedMsgs, context, tvs);
             }
         }
         
     }
     
-    tvs.push_back(TemplateValues("notice"));
-    TemplateValues& endTv = tvs.back();
-    endTv["%%MESSAGE%%"] = formatString(getLocaleString("%s Ends >>"), title.c_str());
-    endTv["%%EXTRA_CLS%%"] = "fmsgtag";   // tag for forwarded msg
+    TemplateValues& endTv = tvs.push("notice");
+    endTv[TK_MESSAGE] = formatString(getLocaleString("%s Ends >>"), title.c_str());
+    endTv[TK_EXTRA_CLS] = "fmsgtag";   // tag for forwarded msg
     
     return true;
 }
@@ -1964,12 +2598,13 @@ bool SessionParser::requireFile(const std::string& vpath, const std::string& des
         {
             normalizePath(srcPath);
             std::string destPath = normalizePath(dest);
-            bool result = m_shell.copyFile(srcPath, destPath, true);
-            if (result)
+            time_t mtime = ITunesDb::parseModifiedTime(file->blob);
+            // Files linked to the backup are shared already
+            if ((m_options & SPO_SHARED_ASSETS) == SPO_SHARED_ASSETS && !m_fileCopier.isLinkingFiles() && m_assetStore.requireFile(file->fileId, srcPath, mtime, destPath))
             {
-                updateFileTime(dest, ITunesDb::parseModifiedTime(file->blob));
+                return true;
             }
-            return result;
+            return m_fileCopier.copyFile(srcPath, destPath, mtime);
         }
     }
     
@@ -1984,8 +2619,5 @@ std::string SessionParser::getDisplayTime(int ms) const
 
 void SessionParser::ensureDirectoryExisted(const std::string& path)
 {
-    if (m_shell.existsDirectory(path))
-    {
-        m_shell.makeDirectory(path);
-    }
+    m_outputTree.ensureDirectory(path);
 }
@@ -15,12 +15,25 @@
 #include <vector>
 #include <atomic>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <set>
+#include <mutex>
 #include "Utils.h"
 #include "Shell.h"
 #include "Downloader.h"
 #include "ByteArrayLocater.h"
 #include "WechatObjects.h"
 #include "ITunesParser.h"
+#include "TemplateValues.h"
+#include "FileCopier.h"
+#include "AssetStore.h"
+#include "MessageReader.h"
+#include "SqliteConnectionPool.h"
+#include "AudioTranscoder.h"
+
+struct sqlite3;
+struct sqlite3_stmt;
 
 template<class T>
 class FilterBase
@@ -298,6 +311,44 @@ struct MsgRecord
     int msgId;
 };
 
+// Position of the last exported message of a session, incremental export continues after it
+struct SessionWatermark
+{
+    int msgId;          // MesLocalID, 0 for none
+    int createTime;
+
+    SessionWatermark() : msgId(0), createTime(0)
+    {
+    }
+};
+
+// Where the rows of a session go: render turns a row into the text of the page and may run on any thread,
+// write appends the text to the page in the order of the rows on the thread which calls parse, true to cancel
+struct SessionRowSink
+{
+    std::function<void(const TemplateValuesList&, std::string&)> render;
+    std::function<bool(const std::string&)> write;
+};
+
+// Display name and portraits of a sender of a chatroom, as the messages render them
+struct SenderInfo
+{
+    std::string name;           // html-escaped unless SPO_IGNORE_HTML_ENC
+    std::string localPortrait;
+    std::string remotePortrait;
+};
+
+// Scratch buffers owned by one parsing thread, so that parseRow can run on several workers at the same time
+struct RowParsingContext
+{
+    std::string htmlBuffer;
+    // Senders of the chatroom seen by this thread, keyed by user name
+    // A chatroom has far fewer senders than messages, so each one is resolved only once
+    std::unordered_map<std::string, SenderInfo> senders;
+    // Local paths of the avatars which this thread has registered in the session
+    std::unordered_set<std::string> avatars;
+};
+
 
 struct ForwardMsg
 {
@@ -329,61 +380,13 @@ enum SessionParsingOption
     SPO_IGNORE_HTML_ENC = 1 << 8,
     SPO_TEXT_MODE = 0xFFFF,
     SPO_DESC = 1 << 16,
-    SPO_ICON_IN_SESSION = 1 << 17     // Put Head Icon and Emoji files in the folder of session
-};
-
-class TemplateValues
-{
-private:
-    std::string m_name;
-    std::map<std::string, std::string> m_values;
-    
-public:
-    using const_iterator = std::map<std::string, std::string>::const_iterator;
- 
-public:
-    TemplateValues()
-    {
-    }
-    TemplateValues(const std::string& name) : m_name(name)
-    {
-    }
-    std::string getName() const
-    {
-        return m_name;
-    }
-    void setName(const std::string& name)
-    {
-        m_name = name;
-    }
-    std::string& operator[](const std::string& k)
-    {
-        return m_values[k];
-    }
-    bool hasValue(const std::string& key) const
-    {
-        return m_values.find(key) != m_values.cend();
-    }
-    
-    const_iterator cbegin() const
-    {
-        return m_values.cbegin();
-    }
-    
-    const_iterator cend() const
-    {
-        return m_values.cend();
-    }
-    
-    void clear()
-    {
-        m_values.clear();
-    }
-    
-    void clearName()
-    {
-        m_name.clear();
-    }
+    SPO_ICON_IN_SESSION = 1 << 17,    // Put Head Icon and Emoji files in the folder of session
+    SPO_PAGED_OUTPUT = 1 << 18,       // Write the messages after the first page to <session>.pNNNN.js
+    SPO_LINK_FILES = 1 << 19,         // Link media files to the backup instead of copying them
+    SPO_SHARED_ASSETS = 1 << 20,      // Write every distinct media file once into Assets/ and link the files of sessions to it
+    SPO_OVERWRITE_FILES = 1 << 21,    // Write media files again even if the previous export left the same ones
+    SPO_INCREMENTAL = 1 << 22,        // Append the messages after the previous export to its pages, requires SPO_PAGED_OUTPUT and ascending order
+    SPO_RESUME = 1 << 23              // Journal the export and continue the one which was killed or cancelled, from its journal
 };
 
 class SessionParser
@@ -398,7 +401,20 @@ private:
     Downloader& m_downloader;
     Friend m_myself;
     
-    mutable std::vector<unsigned char> m_pcmData;  // buffer
+    unsigned int m_numberOfWorkers; // Threads decoding rows in the pipeline, 1 means parsing on the caller's thread
+    
+    // Avatars of the participants of the current session which are passed to the downloader
+    std::mutex m_avatarsMtx;
+    std::set<std::string> m_avatars;
+    
+    mutable OutputTree m_outputTree;
+    FileCopier m_fileCopier;
+    mutable AssetStore m_assetStore;
+    
+    MessageFilter m_filter;
+    MessageReader::Statistics m_readerStatistics;
+    SqliteConnectionPool m_connectionPool;
+    AudioTranscoder m_audioTranscoder;
     
 public:
     SessionParser(Friend& myself, Friends& friends, const ITunesDb& iTunesDb, const Shell& shell, int options, Downloader& downloader, std::function<std::string(const std::string&)> localeFunc);
@@ -416,8 +432,36 @@ public:
         else
             m_options |= SPO_DESC;
     }
+    const FileCopier& getFileCopier() const
+    {
+        return m_fileCopier;
+    }
+    // Which way the messages of the sessions were read in the order of CreateTime
+    std::string getReaderStatistics() const
+    {
+        return m_readerStatistics.toString();
+    }
+    // Voice messages converted to mp3, e.g.: "120 converted, 0 failed, 35.2/s, max queue depth 16"
+    std::string getAudioStatistics() const
+    {
+        return m_audioTranscoder.getStatistics();
+    }
+    OutputTree& getOutputTree() const
+    {
+        return m_outputTree;
+    }
+    void setMessageFilter(const MessageFilter& filter)
+    {
+        m_filter = filter;
+    }
+    void setNumberOfWorkers(unsigned int numberOfWorkers)
+    {
+        m_numberOfWorkers = numberOfWorkers == 0 ? 1 : numberOfWorkers;
+    }
 
-    int parse(const std::string& userBase, const std::string& outputBase, const Session& session, std::function<bool(const std::vector<TemplateValues>&)> handler);
+    // since: only the messages after it are parsed; last: the last message which is handed to the handler
+    // -1 if the messages can't be read completely, the ones before the failure are handed to the handler already
+    int parse(const std::string& userBase, const std::string& outputBase, const Session& session, const SessionWatermark& since, SessionWatermark& last, const SessionRowSink& sink);
 
 private:
 	std::string getLocaleString(const std::string& key) const
@@ -426,13 +470,21 @@ private:
     }
     
     std::string getDisplayTime(int ms) const;
+    // Appends the conditions of the filter to the query, with placeholders for the senders, which are returned in order
+    void buildFilterConditions(const Session& session, std::vector<std::string>& conditions, std::vector<std::string>& senderPrefixes) const;
     bool requireFile(const std::string& vpath, const std::string& dest) const;
-    bool parseRow(MsgRecord& record, const std::string& userBase, const std::string& path, const Session& session, std::vector<TemplateValues>& tvs);
-    bool parseForwardedMsgs(const std::string& userBase, const std::string& outputPath, const Session& session, const MsgRecord& record, const std::string& title, const std::string& message, std::vector<TemplateValues>& tvs);
+    int parseWithPipeline(MessageReader& messageReader, const std::string& userBase, const std::string& outputBase, const Session& session, SessionWatermark& last, const SessionRowSink& sink);
+    // Ranges of rowids for reading in parallel, false if the table isn't large enough
+    bool splitIntoRanges(SqliteConnection& connection, const std::string& table, const std::vector<std::string>& conditions, const MessageReader::ParameterBinder& binder, std::vector<std::pair<int64_t, int64_t>>& ranges) const;
+    int parseRanges(const std::vector<std::pair<int64_t, int64_t>>& ranges, const std::vector<std::string>& conditions, const MessageReader::ParameterBinder& binder, const std::string& userBase, const std::string& outputBase, const Session& session, SessionWatermark& last, const SessionRowSink& sink, bool& complete);
+    bool parseRow(MsgRecord& record, RowParsingContext& context, const std::string& userBase, const std::string& path, const Session& session, TemplateValuesList& tvs);
+    bool parseForwardedMsgs(const std::string& userBase, const std::string& outputPath, const Session& session, const MsgRecord& record, const std::string& title, const std::string& message, RowParsingContext& context, TemplateValuesList& tvs);
     std::string buildContentFromTemplateValues(const TemplateValues& values) const;
     void parseImage(const std::string& sessionPath, const std::string& sessionAssertsPath, const std::string& src, const std::string& srcPre, const std::string& dest, const std::string& srcThumb, const std::string& destThumb, TemplateValues& templateValues);
     void parseVideo(const std::string& sessionPath, const std::string& sessionAssertsPath, const std::string& src, const std::string& dest, const std::string& srcThumb, const std::string& destThumb, TemplateValues& templateValues);
     void parseFile(const std::string& sessionPath, const std::string& sessionAssertsPath, const std::string& src, const std::string& dest, const std::string& fileName, TemplateValues& templateValues);
+    void registerAvatar(const std::string& remotePortrait, const std::string& localPortrait, const std::string& outputPath, unsigned int createTime, RowParsingContext& context);
+    const SenderInfo& resolveSender(const std::string& senderId, const std::string& portraitPath, const std::string& outputPath, const Session& session, unsigned int createTime, RowParsingContext& context);
     void parseCard(const std::string& sessionPath, const std::string& portraitDir, const std::string& cardMessage, TemplateValues& templateValues);
     
     void ensureDirectoryExisted(const std::string& path);
@@ -0,0 +1,257 @@
+//
+//  bench_sqliteprofile.cpp
+//  WechatExporter
+//
+//  Created by Matthew on 2026/10/18.
+//  Copyright © 2026 Matthew. All rights reserved.
+//
+//  Benchmark of SqliteReadProfile on a Chat_ table: the full scan which exports a session, lookups by rowid
+//  as the sorted path of MessageReader reads the rows, and ORDER BY CreateTime, which sorts in the temp store
+//  Every case runs with the SQLite defaults, with the profile without mmap and with the profile mapping up to 256 MB
+//  and up to the whole file, cold (the pages of the file are dropped from the page cache first, where posix_fadvise can)
+//  and warm
+//  The database is created if the path doesn't exist (rows: 5000000 by default, ~2.7 GB):
+//      bench_sqliteprofile <path> [rows]
+//  It isn't part of the projects, build it with the sources it needs:
+//      g++ -std=c++14 -O2 -I. bench_sqliteprofile.cpp Utils.cpp FileCopier.cpp OutputTree.cpp -lsqlite3 -o bench_sqliteprofile
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <sqlite3.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "Utils.h"
+
+#define BENCH_DEFAULT_ROWS  5000000
+#define BENCH_LOOKUPS       300000
+#define BENCH_ROUNDS        3
+
+struct BenchProfile
+{
+    const char* name;
+    bool useProfile;
+    uint64_t maxMmapSize;
+};
+
+// The messages are of the lengths of a chat, from a few words to a long share
+static bool createDatabase(const std::string& path, int64_t rows)
+{
+    sqlite3* db = NULL;
+    if (sqlite3_open(path.c_str(), &db) != SQLITE_OK)
+    {
+        sqlite3_close(db);
+        return false;
+    }
+    sqlite3_exec(db, "PRAGMA journal_mode=OFF;PRAGMA synchronous=OFF;", NULL, NULL, NULL);
+    bool succeeded = sqlite3_exec(db, "CREATE TABLE Chat_bench(MesLocalID INTEGER PRIMARY KEY AUTOINCREMENT, MesSvrID INTEGER, CreateTime INTEGER, Message TEXT, Status INTEGER, ImgStatus INTEGER, Type INTEGER, Des INTEGER)", NULL, NULL, NULL) == SQLITE_OK;
+    sqlite3_stmt* stmt = NULL;
+    if (succeeded)
+    {
+        succeeded = sqlite3_prepare_v2(db, "INSERT INTO Chat_bench(MesSvrID,CreateTime,Message,Status,ImgStatus,Type,Des) VALUES(?,?,?,2,1,?,?)", -1, &stmt, NULL) == SQLITE_OK;
+    }
+    std::mt19937 rng(20261018);
+    std::string message;
+    sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+    for (int64_t idx = 0; succeeded && idx < rows; ++idx)
+    {
+        unsigned int r = rng() % 100;
+        size_t length = r < 70 ? (10 + rng() % 90) : (r < 95 ? (100 + rng() % 900) : (1000 + rng() % 3000));
+        message.assign(length, 'a' + static_cast<char>(idx % 26));
+        sqlite3_bind_int64(stmt, 1, static_cast<sqlite3_int64>(rng()) << 20 | idx);
+        sqlite3_bind_int64(stmt, 2, 1500000000 + idx * 30 + rng() % 30);
+        sqlite3_bind_text(stmt, 3, message.c_str(), static_cast<int>(message.size()), SQLITE_TRANSIENT);
+        sqlite3_bind_int(stmt, 4, r < 80 ? 1 : (r < 90 ? 3 : 49));
+        sqlite3_bind_int(stmt, 5, idx % 2);
+        succeeded = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+    succeeded = sqlite3_exec(db, "COMMIT", NULL, NULL, NULL) == SQLITE_OK && succeeded;
+    sqlite3_close(db);
+    return succeeded;
+}
+
+static void dropPageCache(const std::string& path)
+{
+#if !defined(_WIN32) && defined(POSIX_FADV_DONTNEED)
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd != -1)
+    {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+#endif
+}
+
+static sqlite3* openDatabase(const std::string& path, const BenchProfile& profile)
+{
+    SqliteReadProfile readProfile;
+    if (profile.useProfile)
+    {
+        readProfile.maxMmapSize = profile.maxMmapSize;
+    }
+    else
+    {
+        readProfile.maxMmapSize = 0;
+        readProfile.cacheSize = 0;
+        readProfile.tempStoreInMemory = false;
+        readProfile.queryOnly = false;
+    }
+    setSqliteReadProfile(readProfile);
+    sqlite3* db = NULL;
+    if (openSqlite3ReadOnly(path, &db) != SQLITE_OK)
+    {
+        sqlite3_close(db);
+        return NULL;
+    }
+    return db;
+}
+
+// Seconds, 0 if it fails
+static double run(const std::string& path, const std::string& table, const BenchProfile& profile, int query, int64_t maxRowId, bool cold)
+{
+    if (cold)
+    {
+        dropPageCache(path);
+    }
+    sqlite3* db = openDatabase(path, profile);
+    if (NULL == db)
+    {
+        return 0;
+    }
+
+    std::string sql;
+    switch (query)
+    {
+        case 0:
+            sql = "SELECT CreateTime,Message,Des,Type,MesLocalID FROM " + table;
+            break;
+        case 1:
+            sql = "SELECT CreateTime,Message,Des,Type,MesLocalID FROM " + table + " WHERE rowid=?";
+            break;
+        default:
+            sql = "SELECT MesLocalID FROM " + table + " ORDER BY CreateTime DESC";
+            break;
+    }
+    sqlite3_stmt* stmt = NULL;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL) != SQLITE_OK)
+    {
+        sqlite3_close(db);
+        return 0;
+    }
+    uint64_t bytes = 0;
+    if (query == 1)
+    {
+        std::mt19937 rng(7);
+        for (int idx = 0; idx < BENCH_LOOKUPS; ++idx)
+        {
+            sqlite3_bind_int64(stmt, 1, 1 + static_cast<int64_t>(rng() % static_cast<uint64_t>(maxRowId)));
+            if (sqlite3_step(stmt) == SQLITE_ROW)
+            {
+                bytes += sqlite3_column_bytes(stmt, 1);
+            }
+            sqlite3_reset(stmt);
+        }
+    }
+    else
+    {
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            bytes += sqlite3_column_bytes(stmt, 0);
+        }
+    }
+    sqlite3_finalize(stmt);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    sqlite3_close(db);
+    return bytes > 0 ? seconds : 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("usage: %s <database> [rows]\n", argv[0]);
+        return 1;
+    }
+    std::string path = argv[1];
+    uint64_t fileSize = 0;
+    time_t mtime = 0;
+    if (!getFileSizeAndTime(path, fileSize, mtime))
+    {
+        int64_t rows = argc > 2 ? std::atoll(argv[2]) : BENCH_DEFAULT_ROWS;
+        printf("creating %s with %lld rows\n", path.c_str(), static_cast<long long>(rows));
+        if (!createDatabase(path, rows) || !getFileSizeAndTime(path, fileSize, mtime))
+        {
+            printf("can't create the database\n");
+            return 1;
+        }
+    }
+
+    // The first Chat_ table and its largest rowid
+    std::string table;
+    int64_t maxRowId = 0;
+    sqlite3* db = NULL;
+    if (openSqlite3ReadOnly(path, &db) == SQLITE_OK)
+    {
+        sqlite3_stmt* stmt = NULL;
+        if (sqlite3_prepare_v2(db, "SELECT name FROM sqlite_master WHERE type='table' AND name LIKE 'Chat\\_%' ESCAPE '\\' LIMIT 1", -1, &stmt, NULL) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            table = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+        }
+        sqlite3_finalize(stmt);
+        if (!table.empty() && sqlite3_prepare_v2(db, ("SELECT max(rowid) FROM " + table).c_str(), -1, &stmt, NULL) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            maxRowId = sqlite3_column_int64(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_close(db);
+    if (table.empty() || maxRowId <= 0)
+    {
+        printf("no Chat_ table in %s\n", path.c_str());
+        return 1;
+    }
+
+    const BenchProfile profiles[] = {
+        { "sqlite defaults", false, 0 },
+        { "profile, no mmap", true, 0 },
+        { "profile, mmap 256 MB", true, 256ULL * 1024 * 1024 },
+        { "profile, mmap file", true, fileSize },
+    };
+    const char* queries[] = { "full scan", "rowid lookups", "ORDER BY CreateTime" };
+    printf("%s: %s, %.1f MB, SQLite %s, SQLITE_MAX_MMAP_SIZE caps mmap_size\n", path.c_str(), table.c_str(), fileSize / (1024.0 * 1024.0), sqlite3_libversion());
+    printf("seconds, best of %d rounds (cold: range of the rounds)\n", BENCH_ROUNDS);
+    for (int query = 0; query < 3; ++query)
+    {
+        printf("%s\n", queries[query]);
+        for (size_t idx = 0; idx < sizeof(profiles) / sizeof(profiles[0]); ++idx)
+        {
+            double coldMin = 0;
+            double coldMax = 0;
+            double warm = 0;
+            for (int round = 0; round < BENCH_ROUNDS; ++round)
+            {
+                double seconds = run(path, table, profiles[idx], query, maxRowId, true);
+                coldMin = round == 0 ? seconds : std::min(coldMin, seconds);
+                coldMax = std::max(coldMax, seconds);
+            }
+            for (int round = 0; round < BENCH_ROUNDS; ++round)
+            {
+                double seconds = run(path, table, profiles[idx], query, maxRowId, false);
+                warm = round == 0 ? seconds : std::min(warm, seconds);
+            }
+            printf("  %-22s cold %6.2f-%6.2f   warm %6.2f\n", profiles[idx].name, coldMin, coldMax, warm);
+        }
+    }
+    return 0;
+}
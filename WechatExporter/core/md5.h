@@ -12,6 +12,10 @@
    and always using it seems to have few disadvantages.  */
 typedef unsigned long uint32;
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 struct MD5Context {
 	uint32 buf[4];
 	uint32 bits[2];
@@ -34,4 +38,8 @@ void MD5Transform (uint32 buf[4], const unsigned char in[64]);
  */
 typedef struct MD5Context MD5_CTX;
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* !MD5_H */
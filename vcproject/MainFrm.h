@@ -38,6 +38,8 @@ public:
 		COMMAND_ID_HANDLER(ID_APP_ABOUT, OnAppAbout)
 		COMMAND_ID_HANDLER(ID_FILE_SAVING_IN_SESSION, OnSavingInSession)
 		COMMAND_ID_HANDLER(ID_FILE_DESC_ORDER, OnDescOrder)
+		COMMAND_ID_HANDLER(ID_FILE_INCREMENTAL, OnIncrementalExport)
+		COMMAND_ID_HANDLER(ID_FILE_RESUMABLE, OnResumableExport)
 		COMMAND_RANGE_HANDLER(ID_FORMAT_HTML, ID_FORMAT_TEXT, OnOutputFormat)
 		CHAIN_MSG_MAP(CUpdateUI<CMainFrame>)
 		CHAIN_MSG_MAP(CFrameWindowImpl<CMainFrame>)
@@ -64,6 +66,8 @@ public:
 		CMenuHandle subMenuFile = menu.GetSubMenu(0);
 		subMenuFile.CheckMenuItem(ID_FILE_DESC_ORDER, m_view.GetDescOrder() ? MF_CHECKED : MF_UNCHECKED);
 		subMenuFile.CheckMenuItem(ID_FILE_SAVING_IN_SESSION, m_view.GetSavingInSession() ? MF_CHECKED : MF_UNCHECKED);
+		subMenuFile.CheckMenuItem(ID_FILE_INCREMENTAL, m_view.GetIncrementalExport() ? MF_CHECKED : MF_UNCHECKED);
+		subMenuFile.CheckMenuItem(ID_FILE_RESUMABLE, m_view.GetResumableExport() ? MF_CHECKED : MF_UNCHECKED);
 
 		CMenuHandle subMenuFormat = menu.GetSubMenu(1);
 		UINT outputFormat = m_view.GetOutputFormat();
@@ -92,6 +96,8 @@ public:
 		CMenuHandle subMenuFile = menu.GetSubMenu(0);
 		subMenuFile.EnableMenuItem(ID_FILE_DESC_ORDER, enabled ? MF_ENABLED : MF_DISABLED);
 		subMenuFile.EnableMenuItem(ID_FILE_SAVING_IN_SESSION, enabled ? MF_ENABLED : MF_DISABLED);
+		subMenuFile.EnableMenuItem(ID_FILE_INCREMENTAL, enabled ? MF_ENABLED : MF_DISABLED);
+		subMenuFile.EnableMenuItem(ID_FILE_RESUMABLE, enabled ? MF_ENABLED : MF_DISABLED);
 		
 		CMenuHandle subMenuFormat = menu.GetSubMenu(1);
 		subMenuFormat.EnableMenuItem(ID_FORMAT_HTML, enabled ? MF_ENABLED : MF_DISABLED);
@@ -131,6 +137,30 @@ public:
 		return 0;
 	}
 
+	LRESULT OnIncrementalExport(WORD wNotifyCode, WORD wID, HWND hWndCtl, BOOL& /*bHandled*/)
+	{
+		CMenuHandle menu = GetMenu();
+		CMenuHandle subMenu = menu.GetSubMenu(0);
+		UINT menuState = subMenu.GetMenuState(ID_FILE_INCREMENTAL, MF_BYCOMMAND);
+		BOOL curIncremental = (menuState != 0xFFFFFFFF) && ((menuState & MF_CHECKED) == MF_CHECKED) ? TRUE : FALSE;
+		subMenu.CheckMenuItem(ID_FILE_INCREMENTAL, MF_BYCOMMAND | (curIncremental ? MF_UNCHECKED : MF_CHECKED));
+		m_view.SetIncrementalExport(!curIncremental);
+		
+		return 0;
+	}
+
+	LRESULT OnResumableExport(WORD wNotifyCode, WORD wID, HWND hWndCtl, BOOL& /*bHandled*/)
+	{
+		CMenuHandle menu = GetMenu();
+		CMenuHandle subMenu = menu.GetSubMenu(0);
+		UINT menuState = subMenu.GetMenuState(ID_FILE_RESUMABLE, MF_BYCOMMAND);
+		BOOL curResumable = (menuState != 0xFFFFFFFF) && ((menuState & MF_CHECKED) == MF_CHECKED) ? TRUE : FALSE;
+		subMenu.CheckMenuItem(ID_FILE_RESUMABLE, MF_BYCOMMAND | (curResumable ? MF_UNCHECKED : MF_CHECKED));
+		m_view.SetResumableExport(!curResumable);
+		
+		return 0;
+	}
+
 	LRESULT OnOutputFormat(WORD wNotifyCode, WORD wID, HWND hWndCtl, BOOL& /*bHandled*/)
 	{
 		CMenuHandle menu = GetMenu();
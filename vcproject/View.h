@@ -526,6 +526,8 @@ public:
 		bool descOrder = GetDescOrder();
 		bool saveFilesInSessionFolder = GetSavingInSession();
 		UINT outputFormat = GetOutputFormat();
+		bool incrementalExport = GetIncrementalExport();
+		bool resumableExport = GetResumableExport();
 
 		CListBox lstboxLogs = GetDlgItem(IDC_LOGS);
 		lstboxLogs.ResetContent();
@@ -568,6 +570,15 @@ public:
 			m_exporter->setExtName("txt");
 			m_exporter->setTemplatesName("templates_txt");
 		}
+		if (incrementalExport)
+		{
+			// Appends to the pages of the previous export in ascending order, whatever the order is
+			m_exporter->setIncrementalExport();
+		}
+		if (resumableExport)
+		{
+			m_exporter->setResuming();
+		}
 		m_exporter->filterUsersAndSessions(usersAndSessions);
 		if (m_exporter->run())
 		{
@@ -945,12 +956,56 @@ public:
 		return TRUE;
 	}
 
+	void SetIncrementalExport(BOOL incrementalExport)
+	{
+		SetOption(TEXT("IncrementalExport"), incrementalExport);
+	}
+
+	BOOL GetIncrementalExport() const
+	{
+		return GetOption(TEXT("IncrementalExport"));
+	}
+
+	void SetResumableExport(BOOL resumableExport)
+	{
+		SetOption(TEXT("ResumableExport"), resumableExport);
+	}
+
+	BOOL GetResumableExport() const
+	{
+		return GetOption(TEXT("ResumableExport"));
+	}
+
 	BOOL IsUIEnabled() const
 	{
 		return ::IsWindowEnabled(GetDlgItem(IDC_EXPORT));
 	}
 
 private:
+	void SetOption(LPCTSTR name, BOOL value) const
+	{
+		CRegKey rk;
+		if (rk.Create(HKEY_CURRENT_USER, TEXT("Software\\WechatExporter"), REG_NONE, REG_OPTION_NON_VOLATILE, KEY_READ | KEY_WRITE) == ERROR_SUCCESS)
+		{
+			rk.SetDWORDValue(name, value);
+			rk.Close();
+		}
+	}
+
+	// FALSE if it's never set
+	BOOL GetOption(LPCTSTR name) const
+	{
+		DWORD dwValue = 0;
+		CRegKey rk;
+		if (rk.Open(HKEY_CURRENT_USER, TEXT("Software\\WechatExporter"), KEY_READ) == ERROR_SUCCESS)
+		{
+			rk.QueryDWORDValue(name, dwValue);
+			rk.Close();
+		}
+
+		return dwValue != 0 ? TRUE : FALSE;
+	}
+
 	BOOL GetDescOrder(CRegKey& rk) const
 	{
 		BOOL descOrder = FALSE;